@@ -0,0 +1,96 @@
+#include <stdlib.h>   // exit(), EXIT_FAILURE, EXIT_SUCCESS, malloc(), free()
+#include <stdio.h>    // printf(), perror()
+#include <string.h>   // memset()
+#include <time.h>     // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h" // init(), spawn(), join(), yield(), st_alloc(), st_arena_reset()
+
+/*******************************************************************************
+                     Allocation heavy threads: st_alloc() vs malloc()
+
+    THREADS threads each run ROUNDS rounds. In every round a thread allocates
+    OBJECTS small objects of 16 to 256 bytes, writes to them and releases all of
+    them at the end of the round.
+
+    The Makefile builds this benchmark against a cooperative sthreads
+    (STHREADS_NO_PREEMPT), so malloc() can not be preempted by another thread
+    calling malloc() and needs no lock, like st_alloc(). The threads yield()
+    after every round. Both versions pay the same scheduling cost, and the
+    difference is the cost of the allocators.
+********************************************************************************/
+
+#define THREADS 8
+#define ROUNDS  20
+#define OBJECTS 1000
+
+static int object_size(int i){
+	return 16 + (i * 37) % 241;
+}
+
+void arena_worker(){
+	for(int r=0; r<ROUNDS; r++){
+		for(int i=0; i<OBJECTS; i++){
+			char *p = st_alloc(object_size(i));
+			if(p == NULL){
+				perror("st_alloc");
+				exit(EXIT_FAILURE);
+			}
+			memset(p, i, object_size(i));
+		}
+		st_arena_reset();
+		yield();
+	}
+	done();
+}
+
+void malloc_worker(){
+	char *objects[OBJECTS];
+
+	for(int r=0; r<ROUNDS; r++){
+		for(int i=0; i<OBJECTS; i++){
+			objects[i] = malloc(object_size(i));
+			if(objects[i] == NULL){
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+			memset(objects[i], i, object_size(i));
+		}
+		for(int i=0; i<OBJECTS; i++){
+			free(objects[i]);
+		}
+		yield();
+	}
+	done();
+}
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+double run(void (*worker)()){
+	double start = now();
+	for(int i=0; i<THREADS; i++){
+		spawn(worker);
+	}
+	for(int i=0; i<THREADS; i++){
+		join();
+	}
+	return now() - start;
+}
+
+int main(){
+	init();
+
+	double allocs = (double) THREADS * ROUNDS * OBJECTS;
+	double t_malloc = run(malloc_worker);
+	double t_arena = run(arena_worker);
+
+	printf("%d threads x %d rounds x %d objects\n", THREADS, ROUNDS, OBJECTS);
+	printf("malloc()+free(): %.3f s (%.1f ns/object)\n", t_malloc, t_malloc * 1E9 / allocs);
+	printf("st_alloc():      %.3f s (%.1f ns/object)\n", t_arena, t_arena * 1E9 / allocs);
+	printf("speedup:         %.1fx\n", t_malloc / t_arena);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>   // exit(), EXIT_FAILURE, EXIT_SUCCESS, mkstemp()
+#include <stdio.h>    // printf(), perror()
+#include <string.h>   // memset()
+#include <unistd.h>   // write(), fsync(), close(), unlink()
+#include <time.h>     // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h" // init(), spawn(), yield(), st_blocking(), wg_...()
+
+/*******************************************************************************
+                   Scheduler latency with blocking file I/O
+
+    IO_THREADS threads each write and fsync() a file OPS times while
+    CPU_THREADS threads compute. A ticker thread measures the time between two
+    of its turns on the CPU, which is the scheduler latency every thread sees.
+
+    The benchmark runs twice: with the file I/O called directly from the
+    threads, and offloaded to helper kernel threads with st_blocking().
+********************************************************************************/
+
+#define IO_THREADS  4
+#define CPU_THREADS 4
+#define OPS         50
+#define BLOCK       (1 << 20) // bytes written per operation
+#define MAX_TICKS   1000000
+
+waitgroup_t workers;
+volatile int busy;
+int offload;
+
+char block[BLOCK];
+double gaps[MAX_TICKS];
+long ticks;
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+void *write_sync(void *arg){
+	int fd = (long) arg;
+
+	if(write(fd, block, BLOCK) != BLOCK || fsync(fd) < 0){
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+	return NULL;
+}
+
+void io_worker(){
+	char name[] = "/tmp/blocking_bench.XXXXXX";
+	int fd = mkstemp(name);
+	if(fd < 0){
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+	unlink(name);
+
+	for(int i=0; i<OPS; i++){
+		if(offload){
+			st_blocking(write_sync, (void *) (long) fd);
+		}
+		else{
+			write_sync((void *) (long) fd);
+		}
+	}
+	close(fd);
+	wg_done(&workers);
+}
+
+void cpu_worker(){
+	volatile double x = 0;
+	while(busy){
+		for(int i=0; i<100000; i++){
+			x += i * 0.5;
+		}
+	}
+	wg_done(&workers);
+}
+
+void ticker(){
+	double last = now();
+	while(busy){
+		yield();
+		double t = now();
+		if(ticks < MAX_TICKS){
+			gaps[ticks++] = t - last;
+		}
+		last = t;
+	}
+	wg_done(&workers);
+}
+
+int cmp_double(const void *a, const void *b){
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+void run(int off){
+	offload = off;
+	busy = 1;
+	ticks = 0;
+
+	wg_init(&workers, IO_THREADS);
+	for(int i=0; i<CPU_THREADS; i++){
+		spawn(cpu_worker);
+	}
+	spawn(ticker);
+	double start = now();
+	for(int i=0; i<IO_THREADS; i++){
+		spawn(io_worker);
+	}
+	wg_wait(&workers);
+	double elapsed = now() - start;
+
+	// stop the cpu workers and the ticker
+	wg_init(&workers, CPU_THREADS + 1);
+	busy = 0;
+	wg_wait(&workers);
+
+	double sum = 0;
+	for(long i=0; i<ticks; i++){
+		sum += gaps[i];
+	}
+	qsort(gaps, ticks, sizeof(double), cmp_double);
+
+	printf("%-12s %8.3f s %10.3f ms %10.3f ms %10.3f ms\n",
+	       off ? "st_blocking" : "direct", elapsed, sum / ticks * 1E3,
+	       gaps[ticks * 99 / 100] * 1E3, gaps[ticks - 1] * 1E3);
+}
+
+int main(){
+	init();
+	memset(block, 'x', BLOCK);
+
+	printf("%d io threads x %d x (write %d KB + fsync), %d cpu threads\n",
+	       IO_THREADS, OPS, BLOCK >> 10, CPU_THREADS);
+	printf("%-12s %10s %13s %13s %13s\n", "file i/o", "time", "mean latency", "p99 latency", "max latency");
+	run(0);
+	run(1);
+
+	exit(EXIT_SUCCESS);
+}
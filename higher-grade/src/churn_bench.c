@@ -0,0 +1,93 @@
+#include <stdlib.h>   // exit(), EXIT_FAILURE, EXIT_SUCCESS, atoi()
+#include <stdio.h>    // printf(), perror(), fopen(), fscanf()
+#include <string.h>   // strcmp()
+#include <unistd.h>   // sysconf(), _SC_PAGESIZE
+#include <time.h>     // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h" // init(), spawn(), spawn_detached(), wg_...()
+
+/*******************************************************************************
+                      Resident memory under spawn churn
+
+    A long running server spawns a short lived worker per request and never
+    joins it. The main thread spawns BATCH fire-and-forget workers per round
+    and waits for them with a wait group, for ROUNDS rounds. The resident set
+    size is printed every REPORT rounds.
+
+    With spawn() the stack and control block of every worker are kept until a
+    join() that never comes, so the RSS grows with every round. With
+    spawn_detached() they are reused and the RSS stays flat.
+
+    Usage: bin/churn_bench [spawn|detached] [rounds]
+********************************************************************************/
+
+#define ROUNDS 200
+#define BATCH  50
+#define REPORT 20
+
+waitgroup_t batch;
+volatile long work;
+
+void worker(){
+	// touch a few pages of the stack like a real request handler would
+	volatile char buf[8192];
+	for(int i=0; i<(int) sizeof(buf); i+=512){
+		buf[i] = i;
+	}
+	work += buf[512];
+	wg_done(&batch);
+	done();
+}
+
+long rss_kb(){
+	long size, resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if(f == NULL){
+		return -1;
+	}
+	if(fscanf(f, "%ld %ld", &size, &resident) != 2){
+		resident = -1;
+	}
+	fclose(f);
+	return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+int main(int argc, char *argv[]){
+	int detached = argc < 2 || strcmp(argv[1], "spawn") != 0;
+	int rounds = argc > 2 ? atoi(argv[2]) : ROUNDS;
+
+	init();
+
+	printf("%s, %d rounds x %d workers\n", detached ? "spawn_detached()" : "spawn()", rounds, BATCH);
+	printf("%8s %10s %10s\n", "round", "threads", "rss kB");
+
+	double start = now();
+	for(int r=1; r<=rounds; r++){
+		wg_init(&batch, BATCH);
+		for(int i=0; i<BATCH; i++){
+			if(detached){
+				spawn_detached(worker);
+			}
+			else{
+				spawn(worker);
+			}
+		}
+		wg_wait(&batch);
+		yield(); // let the last worker finish done()
+
+		if(r % REPORT == 0){
+			printf("%8d %10d %10ld\n", r, r * BATCH, rss_kb());
+		}
+	}
+	double secs = now() - start;
+
+	printf("%.0f threads/s\n", rounds * BATCH / secs);
+
+	exit(EXIT_SUCCESS);
+}
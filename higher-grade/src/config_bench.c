@@ -0,0 +1,106 @@
+#include <stdlib.h>   // exit(), EXIT_SUCCESS, atoi()
+#include <stdio.h>    // printf()
+#include <time.h>     // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h" // init(), spawn(), yield(), join(), lock(), sem_...()
+
+/*******************************************************************************
+                    Cost of the API in each configuration
+
+    Measures the basic operations of sthreads. The Makefile builds this
+    benchmark against several compile-time configurations of the library (see
+    sthreads_config.h):
+
+        bin/config_bench        default, preemptive with instrumentation
+        bin/config_bench_coop   -DSTHREADS_NO_PREEMPT
+        bin/config_bench_lean   cooperative, static thread table, no instrumentation
+
+    Usage: bin/config_bench [iterations]
+********************************************************************************/
+
+#define ITERATIONS 200000
+
+int iterations;
+mutex_t m;
+sem_t ping, pong;
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+void yielder(){
+	for(int i=0; i<iterations; i++){
+		yield();
+	}
+	done();
+}
+
+void ponger(){
+	for(int i=0; i<iterations; i++){
+		sem_wait(&ping);
+		sem_post(&pong);
+	}
+	done();
+}
+
+void nothing(){
+	done();
+}
+
+void report(const char *what, double secs, long ops){
+	printf("%-24s %10.1f ns/op\n", what, secs * 1E9 / ops);
+}
+
+int main(int argc, char *argv[]){
+	iterations = argc > 1 ? atoi(argv[1]) : ITERATIONS;
+
+	init();
+	lock_init(&m);
+	sem_init(&ping, 0, 0);
+	sem_init(&pong, 0, 0);
+
+#ifdef STHREADS_NO_PREEMPT
+	printf("preemption:      off\n");
+#else
+	printf("preemption:      on\n");
+#endif
+	printf("max threads:     %d%s\n", STHREADS_MAX_THREADS, STHREADS_MAX_THREADS == 0 ? " (dynamic)" : "");
+	printf("instrumentation: %s\n\n", STHREADS_INSTRUMENT ? "on" : "off");
+
+	// two threads yielding to each other, one switch per yield()
+	double start = now();
+	spawn(yielder);
+	for(int i=0; i<iterations; i++){
+		yield();
+	}
+	join();
+	report("yield() switch", now() - start, 2L * iterations);
+
+	start = now();
+	for(int i=0; i<iterations; i++){
+		lock(&m);
+		unlock(&m);
+	}
+	report("lock()+unlock()", now() - start, iterations);
+
+	// a round trip is two sem_post() waking a thread blocked in sem_wait()
+	start = now();
+	spawn(ponger);
+	for(int i=0; i<iterations; i++){
+		sem_post(&ping);
+		sem_wait(&pong);
+	}
+	join();
+	report("sem_post() handoff", now() - start, 2L * iterations);
+
+	start = now();
+	for(int i=0; i<iterations / 10; i++){
+		spawn(nothing);
+		join();
+	}
+	report("spawn()+join()", now() - start, iterations / 10);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,111 @@
+#include <stdlib.h>   // exit(), EXIT_FAILURE, EXIT_SUCCESS, atoi()
+#include <stdio.h>    // printf(), fprintf()
+#include <stdint.h>   // intptr_t
+#include <time.h>     // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h" // init(), spawn_future(), future_get(), future_free()
+
+/*******************************************************************************
+                       Fork-join parallel fib() benchmark
+
+    The deliberately slow recursive fib() of sthreads_test.c as a fork-join
+    computation. Every call with n above the cutoff spawns a thread for
+    fib(n-1) with spawn_future(), computes fib(n-2) itself and joins the child
+    with future_get(). Calls at or below the cutoff run sequentially.
+
+    For each cutoff the benchmark reports the number of tasks (spawned
+    threads), tasks per second, the overhead per spawn and join compared with
+    the sequential fib(n), and the speedup over it.
+
+    All sthreads run on one kernel thread, so the speedup can not exceed 1 and
+    measures how much of the sequential speed the spawn and join cost leave.
+
+    Usage: bin/fib_bench [n] [cutoff ...]
+********************************************************************************/
+
+#define N 27
+#define MAX_CUTOFFS 16
+
+int cutoffs[MAX_CUTOFFS] = {20, 15, 10, 7};
+int num_cutoffs = 4;
+
+int cutoff;
+long tasks;
+
+int fib(int n) {
+  switch (n) {
+  case 0:
+    return 0;
+  case 1:
+    return 1;
+  default:
+    return fib(n-1) + fib(n-2);
+  }
+}
+
+int pfib(int n);
+
+void *pfib_task(void *arg){
+	return (void *) (intptr_t) pfib((intptr_t) arg);
+}
+
+int pfib(int n){
+	if(n <= cutoff){
+		return fib(n);
+	}
+
+	future_t *child = spawn_future(pfib_task, (void *) (intptr_t) (n-1));
+	if(child == NULL){
+		fprintf(stderr, "[ERROR] spawn_future() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	__atomic_add_fetch(&tasks, 1, __ATOMIC_RELAXED); // the thread may be preempted
+	int b = pfib(n-2);
+	int a = (intptr_t) future_get(child);
+	future_free(child);
+
+	return a + b;
+}
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+int main(int argc, char *argv[]){
+	int n = argc > 1 ? atoi(argv[1]) : N;
+	if(argc > 2){
+		num_cutoffs = 0;
+		for(int i=2; i<argc && num_cutoffs<MAX_CUTOFFS; i++){
+			cutoffs[num_cutoffs++] = atoi(argv[i]);
+		}
+	}
+
+	init();
+
+	double start = now();
+	int expected = fib(n);
+	double seq = now() - start;
+	printf("fib(%d) = %d, sequential %.3f s, 1 kernel thread\n\n", n, expected, seq);
+	printf("%8s %10s %10s %12s %14s %8s\n", "cutoff", "tasks", "seconds", "tasks/s",
+		"us/spawn+join", "speedup");
+
+	for(int i=0; i<num_cutoffs; i++){
+		cutoff = cutoffs[i];
+		tasks = 0;
+
+		start = now();
+		int result = pfib(n);
+		double secs = now() - start;
+
+		if(result != expected){
+			fprintf(stderr, "[ERROR] fib(%d) = %d, expected %d\n", n, result, expected);
+			exit(EXIT_FAILURE);
+		}
+		printf("%8d %10ld %10.3f %12.0f %14.2f %8.3f\n", cutoff, tasks, secs,
+			tasks / secs, tasks > 0 ? (secs - seq) * 1E6 / tasks : 0, seq / secs);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>       // exit(), EXIT_FAILURE, EXIT_SUCCESS, atoi()
+#include <stdio.h>        // printf(), perror()
+#include <sys/time.h>     // struct timeval
+#include <sys/resource.h> // getrusage(), RUSAGE_SELF
+#include <time.h>         // clock_gettime(), CLOCK_MONOTONIC
+
+#include "sthreads.h"     // init(), spawn(), st_sleep(), st_park(), st_unpark()
+
+/*******************************************************************************
+                      Idle CPU usage of a mostly idle server
+
+    PARKED worker threads park waiting for a request. Every TICK microseconds
+    the main thread hands a request to one of them with st_unpark() and goes
+    back to sleep. Nothing else runs, so the process should use next to no CPU
+    while it waits.
+
+    Usage: bin/idle_bench [threads] [seconds]
+********************************************************************************/
+
+#define PARKED  10000
+#define SECONDS 5
+#define TICK    100000 // us
+
+tid_t *workers;
+int served = 0;
+
+void worker(){
+	while(1){
+		st_park();
+		served++;
+	}
+}
+
+double seconds(struct timeval tv){
+	return tv.tv_sec + tv.tv_usec * 1E-6;
+}
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+int main(int argc, char *argv[]){
+	int parked = argc > 1 ? atoi(argv[1]) : PARKED;
+	int secs = argc > 2 ? atoi(argv[2]) : SECONDS;
+	struct rusage before, after;
+
+	init();
+
+	workers = malloc(sizeof(tid_t) * parked);
+	if(workers == NULL){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for(int i=0; i<parked; i++){
+		workers[i] = spawn(worker);
+	}
+	st_sleep(TICK); // let every worker park
+
+	getrusage(RUSAGE_SELF, &before);
+	double start = now();
+
+	int ticks = secs * 1000000 / TICK;
+	for(int i=0; i<ticks; i++){
+		st_unpark(workers[i % parked]);
+		st_sleep(TICK);
+	}
+
+	double wall = now() - start;
+	getrusage(RUSAGE_SELF, &after);
+
+	double user = seconds(after.ru_utime) - seconds(before.ru_utime);
+	double sys = seconds(after.ru_stime) - seconds(before.ru_stime);
+
+	printf("parked threads:   %d\n", parked);
+	printf("requests served:  %d\n", served);
+	printf("wall time:        %.3f s\n", wall);
+	printf("cpu time:         %.3f s user, %.3f s sys\n", user, sys);
+	printf("idle cpu usage:   %.3f %%\n", 100 * (user + sys) / wall);
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>   // exit(), EXIT_FAILURE
+#include <stdio.h>    // fprintf()
+#include <errno.h>    // EAGAIN, EBUSY
+#include <time.h>     // struct timespec
+#include <unistd.h>   // sleep(), usleep()
+#include <pthread.h>  // pthread_t, pthread_mutex_t, pthread_cond_t
+#include <sched.h>    // sched_yield()
+
+#include "sthreads.h" // init(), spawn_future(), future_get(), lock(), cond_wait()
+
+/*******************************************************************************
+                   pthread compatible shim on top of sthreads
+
+    Implements the common subset of the pthread API with sthreads so that an
+    unmodified pthread program runs all its threads as green threads in one
+    kernel thread. Either link the program with obj/pthread_shim.o and
+    obj/sthreads.o, or run it with
+
+        LD_PRELOAD=bin/libsthreads_pthread.so ./program
+
+    sthreads is initialized before main(). A pthread_t is the future_t of the
+    thread and pthread_join() returns its result. The mutex_t, cond_t and sem_t
+    of sthreads are stored in the memory of the pthread and POSIX types, the
+    POSIX sem_init(), sem_wait() and sem_post() are the ones of sthreads.c.
+    sleep(), usleep() and nanosleep() only suspend the calling thread.
+
+    Not supported: thread attributes, cancellation, timed waits, process
+    shared primitives and st_blocking(), whose helper kernel threads would use
+    the shim themselves.
+********************************************************************************/
+
+_Static_assert(sizeof(mutex_t) <= sizeof(pthread_mutex_t), "mutex_t does not fit in pthread_mutex_t");
+_Static_assert(sizeof(cond_t) <= sizeof(pthread_cond_t), "cond_t does not fit in pthread_cond_t");
+_Static_assert(sizeof(sem_t) <= 4 * sizeof(void *), "sem_t does not fit in the POSIX sem_t");
+_Static_assert(sizeof(future_t *) <= sizeof(pthread_t), "future_t * does not fit in pthread_t");
+
+/* Threads only switch in sthreads calls unless STHREADS_POLICY asks for
+   preemption: glibc (malloc(), stdio) is not safe to re-enter from another
+   green thread of the same kernel thread.
+*/
+__attribute__((constructor))
+static void shim_init(){
+	int ok = getenv("STHREADS_POLICY") != NULL ? init() : init_policy(&sched_fifo);
+	if(ok < 0){
+		fprintf(stderr, "[ERROR] pthread shim - init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*		------------------ Threads ------------------		*/
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+                   void *(*start)(void *), void *arg){
+	future_t *f = spawn_future(start, arg);
+	if(f == NULL){
+		return EAGAIN;
+	}
+	*thread = (pthread_t) f;
+	return 0;
+}
+
+int pthread_join(pthread_t thread, void **retval){
+	future_t *f = (future_t *) thread;
+	void *result = future_get(f);
+	if(retval != NULL){
+		*retval = result;
+	}
+	future_free(f);
+	return 0;
+}
+
+void pthread_exit(void *retval){
+	future_exit(retval);
+	exit(EXIT_FAILURE); // not reached
+}
+
+int sched_yield(void){
+	yield();
+	return 0;
+}
+
+/*		------------------ Mutexes ------------------		*/
+
+int pthread_mutex_init(pthread_mutex_t *m, const pthread_mutexattr_t *attr){
+	lock_init((mutex_t *) m);
+	return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *m){
+	return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m){
+	lock((mutex_t *) m);
+	return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m){
+	return trylock((mutex_t *) m) == 0 ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m){
+	unlock((mutex_t *) m);
+	return 0;
+}
+
+/*		------------------ Condition Variables ------------------		*/
+
+int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *attr){
+	cond_init((cond_t *) c);
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *c){
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m){
+	cond_wait((cond_t *) c, (mutex_t *) m);
+	return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *c){
+	cond_signal((cond_t *) c);
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c){
+	cond_broadcast((cond_t *) c);
+	return 0;
+}
+
+/*		------------------ Semaphores ------------------		*/
+
+// sem_init(), sem_wait() and sem_post() are defined in sthreads.c
+
+int sem_destroy(sem_t *s){
+	return 0;
+}
+
+int sem_getvalue(sem_t *s, int *value){
+	*value = s->value < 0 ? 0 : s->value;
+	return 0;
+}
+
+/*		------------------ Sleeping ------------------		*/
+
+unsigned int sleep(unsigned int seconds){
+	st_sleep(seconds * 1000000L);
+	return 0;
+}
+
+int usleep(useconds_t usec){
+	st_sleep(usec);
+	return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem){
+	if(req->tv_nsec < 0 || req->tv_nsec >= 1000000000L){
+		errno = EINVAL;
+		return -1;
+	}
+	st_sleep(req->tv_sec * 1000000L + (req->tv_nsec + 999) / 1000);
+	if(rem != NULL){
+		rem->tv_sec = 0;
+		rem->tv_nsec = 0;
+	}
+	return 0;
+}
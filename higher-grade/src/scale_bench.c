@@ -0,0 +1,247 @@
+#include <stdlib.h>       // exit(), EXIT_FAILURE, EXIT_SUCCESS, atol(), malloc()
+#include <stdio.h>        // printf(), perror(), fopen(), fscanf()
+#include <unistd.h>       // fork(), getopt(), sysconf(), _SC_PAGESIZE, _SC_PHYS_PAGES
+#include <time.h>         // clock_gettime(), CLOCK_MONOTONIC
+#include <signal.h>       // SIGXCPU, SIGKILL
+#include <sys/mman.h>     // mmap(), MAP_SHARED, MAP_ANONYMOUS
+#include <sys/wait.h>     // waitpid(), WIFEXITED(), WIFSIGNALED()
+#include <sys/resource.h> // setrlimit(), RLIMIT_CPU
+
+#include "sthreads.h" // init(), spawn_detached(), st_park(), st_unpark(), wg_...()
+
+/*******************************************************************************
+                  Scalability with many mostly parked threads
+
+    For 10^3, 10^4, ... up to the maximum number of threads, a child process
+    spawns that many detached threads that park themselves in st_park() and
+    measures
+
+        spawn     time per spawn_detached() until the thread has parked
+        rss       growth of the resident set size per thread
+        yield     time per switch of two threads yielding to each other while
+                  all the others are parked
+        wake      time for st_unpark() of a parked thread until it has run and
+                  parked again
+        teardown  time per thread to unpark all threads and let them terminate
+
+    Every size runs in its own process, which is killed after the CPU time
+    limit or stopped when its resident set grows above the memory limit. The
+    benchmark fails when a size does not complete or its spawn time or RSS per
+    thread is above the budget.
+
+    Usage: bin/scale_bench [-n max threads] [-r rss budget kB/thread]
+                           [-s spawn budget us/thread] [-t CPU seconds per size]
+                           [-m memory limit MB]
+********************************************************************************/
+
+#define MAX_THREADS  1000000
+#define RSS_BUDGET   16      // kB per thread
+#define SPAWN_BUDGET 50      // us per thread
+#define TIME_LIMIT   60      // CPU seconds per size
+#define WAKES        1000    // st_unpark() round trips measured per size
+#define YIELDS       100000  // yield() calls measured per size
+#define RSS_CHECK    1024    // spawns between two checks of the memory limit
+
+// results of one size, written by the child into memory shared with the parent
+// (-1 for a phase that did not complete)
+typedef struct {
+	double spawn_us, rss_kb, yield_ns, wake_ns, teardown_us;
+	int over_memory;
+} result_t;
+
+result_t *result;
+long memory_kb;
+
+tid_t *tids;
+volatile int quit = 0, stop_yield = 0;
+volatile long woken = 0;
+waitgroup_t exited;
+
+void parker(){
+	while(!quit){
+		st_park();
+		woken++;
+	}
+	wg_done(&exited);
+	done();
+}
+
+void yielder(){
+	while(!stop_yield){
+		yield();
+	}
+	done();
+}
+
+long rss_kb(){
+	long size, resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if(f == NULL){
+		return -1;
+	}
+	if(fscanf(f, "%ld %ld", &size, &resident) != 2){
+		resident = -1;
+	}
+	fclose(f);
+	return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+// measures n threads, runs in the child process
+void run(long n){
+	tids = malloc(n * sizeof(tid_t));
+	if(tids == NULL){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	init();
+	wg_init(&exited, n);
+
+	long rss = rss_kb();
+	double start = now();
+	for(long i=0; i<n; i++){
+		tids[i] = spawn_detached(parker);
+		if(tids[i] < 0){
+			exit(EXIT_FAILURE);
+		}
+		if(i % RSS_CHECK == 0 && rss_kb() > memory_kb){
+			result->over_memory = 1;
+			exit(EXIT_FAILURE);
+		}
+	}
+	result->spawn_us = (now() - start) * 1E6 / n;
+	result->rss_kb = (double) (rss_kb() - rss) / n;
+
+	spawn_detached(yielder);
+	start = now();
+	for(int i=0; i<YIELDS; i++){
+		yield();
+	}
+	result->yield_ns = (now() - start) * 1E9 / (2L * YIELDS);
+	stop_yield = 1;
+	yield();
+
+	start = now();
+	for(long i=0; i<WAKES; i++){
+		long before = woken;
+		st_unpark(tids[(i * 7919) % n]);
+		while(woken == before){
+			yield();
+		}
+	}
+	result->wake_ns = (now() - start) * 1E9 / WAKES;
+
+	start = now();
+	quit = 1;
+	for(long i=0; i<n; i++){
+		while(st_unpark(tids[i]) < 0){ // the unpark queue is full
+			yield();
+		}
+	}
+	wg_wait(&exited);
+	yield(); // let the last thread finish done()
+	result->teardown_us = (now() - start) * 1E6 / n;
+
+	exit(EXIT_SUCCESS);
+}
+
+void print_value(double value, const char *format){
+	if(value < 0){
+		printf("%12s", "-");
+	}
+	else{
+		printf(format, value);
+	}
+}
+
+int main(int argc, char *argv[]){
+	long max = MAX_THREADS;
+	double rss_budget = RSS_BUDGET, spawn_budget = SPAWN_BUDGET;
+	rlim_t cpu = TIME_LIMIT;
+	memory_kb = sysconf(_SC_PHYS_PAGES) / 2 * (sysconf(_SC_PAGESIZE) / 1024);
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:s:t:m:")) != -1){
+		switch(opt){
+			case 'n': max = atol(optarg); break;
+			case 'r': rss_budget = atof(optarg); break;
+			case 's': spawn_budget = atof(optarg); break;
+			case 't': cpu = atol(optarg); break;
+			case 'm': memory_kb = atol(optarg) * 1024; break;
+			default:
+				fprintf(stderr, "usage: %s [-n max threads] [-r rss kB/thread] [-s spawn us/thread] "
+					"[-t CPU seconds per size] [-m memory MB]\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	result = mmap(NULL, sizeof(result_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(result == MAP_FAILED){
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("budget: %.1f kB and %.1f us per thread, %ld s CPU and %ld MB per size\n",
+		rss_budget, spawn_budget, (long) cpu, memory_kb / 1024);
+	printf("%10s %12s %12s %12s %12s %12s  %s\n", "threads", "spawn us", "rss kB",
+		"yield ns", "wake ns", "teardown us", "result");
+
+	int failed = 0;
+	for(long n=1000; n<=max; n*=10){
+		*result = (result_t) {-1, -1, -1, -1, -1, 0};
+		fflush(stdout);
+
+		pid_t pid = fork();
+		if(pid < 0){
+			perror("fork");
+			exit(EXIT_FAILURE);
+		}
+		if(pid == 0){
+			struct rlimit limit = {cpu, cpu + 1}; // SIGXCPU, then SIGKILL
+			setrlimit(RLIMIT_CPU, &limit);
+			run(n);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+
+		printf("%10ld", n);
+		print_value(result->spawn_us, "%12.2f");
+		print_value(result->rss_kb, "%12.2f");
+		print_value(result->yield_ns, "%12.1f");
+		print_value(result->wake_ns, "%12.1f");
+		print_value(result->teardown_us, "%12.2f");
+
+		const char *verdict = "ok";
+		if(WIFSIGNALED(status) && (WTERMSIG(status) == SIGXCPU || WTERMSIG(status) == SIGKILL)){
+			verdict = "FAIL: CPU time limit";
+		}
+		else if(result->over_memory){
+			verdict = "FAIL: memory limit";
+		}
+		else if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS){
+			verdict = "FAIL: crashed";
+		}
+		else if(result->rss_kb > rss_budget){
+			verdict = "FAIL: rss over budget";
+		}
+		else if(result->spawn_us > spawn_budget){
+			verdict = "FAIL: spawn over budget";
+		}
+		printf("  %s\n", verdict);
+
+		if(verdict[0] == 'F'){
+			failed = 1;
+			if(result->teardown_us < 0){
+				break; // a larger size will not complete either
+			}
+		}
+	}
+
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -3,6 +3,11 @@
 */
 #define _XOPEN_SOURCE 700
 
+/* dladdr() and the register names of mcontext_t (REG_RIP, REG_RBP) used by the
+   sampling profiler are GNU extensions.
+*/
+#define _GNU_SOURCE
+
 /* On Mac OS when compiling with gcc (clang) the -Wno-deprecated-declarations
    flag must also be used to suppress compiler warnings.
 */
@@ -21,22 +26,101 @@
 #include <ucontext.h>
 #include <sys/time.h>
 #include <string.h>
+#include <time.h>     /* clock_gettime(), CLOCK_MONOTONIC */
+#include <unistd.h>   /* getpid() */
+#include <pthread.h>  /* pthread_create(), pthread_mutex_lock(), pthread_cond_wait() */
+#include <sched.h>    /* sched_yield() */
+#include <dlfcn.h>    /* dladdr() */
 
 /* Stack size for each context. */
-#define STACK_SIZE SIGSTKSZ*100
+#define STACK_SIZE STHREADS_STACK_SIZE
 #define TIMEOUT 20		// us
 #define TIMER_TYPE ITIMER_REAL 	// type of timer
-
-void init_context(ucontext_t *ctx, void(*func)(), ucontext_t *next);
+#define WAKE_SIGNAL SIGUSR2	// signal used by st_unpark() to interrupt idle()
+#define INJECT_SIZE 1024	// number of st_unpark() requests that can be pending
+#define ARENA_SIZE 65536	// bytes of each thread's region set aside for st_alloc()
+#define ARENA_ALIGN 16		// alignment of memory returned by st_alloc()
+#define BLOCKING_THREADS 4	// default number of st_blocking() helper threads
+#define BLOCKING_QUEUE 64	// default number of st_blocking() calls that can be queued
+#define POOL_MAX 64		// number of TCBs and stacks of terminated threads kept for reuse
+#define STRIDE1 (1L << 20)	// stride of a thread with prio 1
+#define PROF_SAMPLES 65536	// number of samples the profiler keeps, later ones are dropped
+#define PROF_DEPTH 32		// frames recorded per sample
+#define PROF_HZ 1000		// default samples per second of CPU time
+
+#if STHREADS_INSTRUMENT
+#define STAT_ON(stat) ((stat) != NULL) // statistics are kept for the primitive
+#else
+#define STAT_ON(stat) 0
+#endif
+
+#ifdef STHREADS_NO_PREEMPT
+// there is no timer to stop, an API call is never preempted
+#define timer_handler NULL
+static inline int stop_timer(int type, void (*handler)(int)){
+	return TIMEOUT;
+}
+static inline void set_timer(int type, void (*handler)(int), long us){
+}
+#endif
+
+#if STHREADS_INSTRUMENT
+// a SIGPROF sample, written by prof_handler() and read at exit
+typedef struct {
+	volatile int valid; // set once the sample is completely written
+	tid_t tid;
+	void (*start)(); // start function of the thread (NULL for main)
+	int depth;
+	void *pc[PROF_DEPTH]; // innermost frame first
+} prof_sample_t;
+#endif
+
+// arena memory allocated with malloc() when a thread's own arena is full
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+} arena_chunk_t;
+
+void init_context(ucontext_t *ctx, void(*func)(), ucontext_t *next, void *stack);
 void init_thread(thread_t * t, void (*start)());
+thread_t * alloc_thread();
+void free_thread(thread_t * t);
+void reap_dying();
+void start_thread();
+tid_t spawn_thread(void (*start)(), void *arg, int detached);
+void start_future();
+void wg_park(waitgroup_t * wg);
+void wg_release(waitgroup_t * wg);
 void schedule();
 void delete_t(int index);
 int get_index(); // returns running thread index, -1 when failed
-
+int find_index(tid_t tid); // returns index of the thread with id tid, -1 when failed
+long now_us();
+long now_ns();
+lockstat_t * lockstat_new(const char *kind, int id, const char *label);
+void lockstat_acquire(lockstat_t * ls, long start);
+void lockstat_release(lockstat_t * ls);
+void lockstat_exit();
+void thread_info(thread_t * t, st_thread_info_t * info);
+void dump_handler(int signum);
+#if STHREADS_INSTRUMENT
+void prof_handler(int signum, siginfo_t *info, void *uc);
+int prof_backtrace(ucontext_t *uc, thread_t *t, void **pc);
+void prof_exit();
+#endif
+void wake_threads();
+thread_t * idle();
+void make_ready(thread_t * t);
+void preempt();
+void arena_release(thread_t * t);
+void *blocking_helper(void *unused);
+
+#ifndef STHREADS_NO_PREEMPT
 int timer_signal(int timer_type);
-void set_timer(int type, void (*handler)(int), int us);
+void set_timer(int type, void (*handler)(int), long us);
 int stop_timer(int type, void (*handler)(int));
 void timer_handler(int signum);
+#endif
+void wake_handler(int signum);
 
 
 /*******************************************************************************
@@ -44,15 +128,67 @@ void timer_handler(int signum);
 
                 Add data structures to manage the threads here.
 ********************************************************************************/
-thread_t * threads;
-int t_ind = 0; // thread cursor
+#if STHREADS_MAX_THREADS > 0
+thread_t * threads[STHREADS_MAX_THREADS]; // thread control blocks are never moved once allocated
+#else
+thread_t ** threads; // thread control blocks are never moved once allocated
+#endif
+thread_t * current = NULL; // the running thread
 int t_num = 0; // thread number
+tid_t t_last = 0; // the thread id given to the last created thread
 int m_ind = 0; // mutex cursor
 int m_num = 0; // mutex number
 int c_num = 0; // cond_t number
 int s_num = 0; // sem_t number
 int s_ind = 0; // semaphore cursor
+int k_num = 0; // st_key_t number
+void (*destructors[ST_KEYS_MAX])(void *); // destructor of each st_key_t (NULL if none)
 tid_t termin = -1; // the thread id that terminated last
+thread_t * pool = NULL; // TCBs of deleted threads with their stacks, linked by next
+int pool_num = 0; // number of TCBs in pool
+thread_t * dying = NULL; // detached thread that called done(), deleted once the scheduler left its stack
+int sleepers = 0; // number of threads in st_sleep()
+int parkers = 0; // number of threads in st_park()
+
+// st_unpark() requests, filled by any kernel thread or signal handler and
+// drained by the scheduler (0 marks an empty slot)
+volatile tid_t inject[INJECT_SIZE];
+volatile unsigned inject_head = 0;
+volatile unsigned inject_tail = 0;
+volatile sig_atomic_t idling = 0; // 1 while idle() sleeps in sigsuspend()
+volatile sig_atomic_t in_api = 0; // 1 from stop_timer() until set_timer(), the timer must not preempt the thread
+const sched_policy_t *policy = &STHREADS_DEFAULT_POLICY; // chooses the next thread to run
+thread_t * rq_head = NULL; // queue of ready threads kept by the policy, linked by next
+thread_t * rq_tail = NULL;
+long stride_pass = 0; // pass of the last thread picked by sched_stride
+int lockstat_on = 0; // 1 once st_lockstat_enable() was called
+lockstat_t * lockstats = NULL; // statistics of all accounted primitives, never freed
+#if STHREADS_INSTRUMENT
+prof_sample_t * prof_samples = NULL; // NULL until st_prof_start()
+volatile unsigned prof_next = 0; // next free sample, only ever incremented
+const char * prof_path = NULL; // folded stacks are written here at exit
+#endif
+char * main_stack_low = NULL; // bounds of main's stack (NULL if unknown)
+char * main_stack_high = NULL;
+
+
+
+// st_blocking() call waiting for or running in a helper thread
+typedef struct {
+	void *(*fn)(void *);
+	void *arg;
+	void *result;
+	tid_t tid; // the thread to unpark when the call returns
+	volatile int done;
+} blocking_call_t;
+
+// bounded queue of st_blocking() calls shared with the helper threads
+pthread_mutex_t b_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t b_cond = PTHREAD_COND_INITIALIZER;
+blocking_call_t ** b_queue = NULL;
+int b_size = 0; // capacity of b_queue, 0 until the helpers are started
+int b_head = 0;
+int b_count = 0;
 
 
 
@@ -62,14 +198,8 @@ tid_t termin = -1; // the thread id that terminated last
                       Add internal helper functions here.
 ********************************************************************************/
 
-void init_context(ucontext_t *ctx, void(*func)(), ucontext_t *next){
-	void *stack = malloc(STACK_SIZE);
-
-	if(stack == NULL){
-		perror("Allocating stack");
-		exit(EXIT_FAILURE);
-	}
-	
+// stack is a region of STACK_SIZE + ARENA_SIZE bytes
+void init_context(ucontext_t *ctx, void(*func)(), ucontext_t *next, void *stack){
 	if(getcontext(ctx) < 0){
 		perror("getcontext");
 		exit(EXIT_FAILURE);
@@ -84,64 +214,197 @@ void init_context(ucontext_t *ctx, void(*func)(), ucontext_t *next){
 }
 
 void init_thread(thread_t * t, void (*start)()){
-	t->tid = t_num;
+	t->tid = ++t_last;
 	t->state = ready;
-	init_context(&(t->ctx), start, NULL);
+	t->start = start;
+	t->arg = NULL;
+	init_context(&(t->ctx), start_thread, NULL, t->ctx.uc_stack.ss_sp);
 	t->next = NULL;
+	t->detached = 0;
 	t->mid = -1;
 	t->cid = -1;
 	t->sid = -1;
+	t->wake = -1;
+	t->parked = 0;
+	t->prio = 1;
+	t->pass = 0;
+	t->wg = NULL;
+	t->arena_base = (char *) t->ctx.uc_stack.ss_sp + STACK_SIZE;
+	t->arena = t->arena_base;
+	t->arena_end = t->arena_base + ARENA_SIZE;
+	t->chunks = NULL;
+	memset(t->tls, 0, sizeof(t->tls));
+	t->run_ns = 0;
+	t->run_start = 0;
 }
 
-void schedule(){
-	// for(int i=0; i<t_num; i++){
-	// 	printf("threads[%d].state: %u\n", i, threads[i].state);
-	// }
-	// printf("schedule\n");
-	if(t_num == 1) { // there is no ready state thread
-		threads[0].state = running;
+// returns a TCB whose ctx.uc_stack.ss_sp is a region for the stack and arena,
+// reused from the pool if possible
+thread_t * alloc_thread(){
+	if(pool != NULL){
+		thread_t *t = pool;
+		pool = t->next;
+		pool_num--;
+		return t;
+	}
+
+	thread_t *t = (thread_t *) malloc(sizeof(thread_t));
+	if(t == NULL){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	// the thread's arena is placed above the stack, which grows away from it
+	t->ctx.uc_stack.ss_sp = malloc(STACK_SIZE + ARENA_SIZE);
+	if(t->ctx.uc_stack.ss_sp == NULL){
+		perror("Allocating stack");
+		exit(EXIT_FAILURE);
+	}
+	return t;
+}
+
+// returns the TCB and stack of a terminated thread to the pool, or frees them
+// when the pool is full
+void free_thread(thread_t * t){
+	arena_release(t);
+	if(pool_num < POOL_MAX){
+		t->next = pool;
+		pool = t;
+		pool_num++;
 		return;
 	}
-	int ready_t = -1;
-	int cur = -1;
-	for(int i=0; i<t_num; i++){
-		t_ind = (t_ind+1) % t_num;
-		if(threads[t_ind].state == ready){
-			ready_t = t_ind;
-			break;
-		}
+	free(t->ctx.uc_stack.ss_sp); // the stack and the thread's own arena
+	free(t);
+}
+
+// deletes the detached thread that terminated last, must not run on its stack
+void reap_dying(){
+	if(dying == NULL || dying == current){
+		return;
 	}
-	
 	for(int i=0; i<t_num; i++){
-		if(threads[i].state == running){
-			cur = i;
+		if(threads[i] == dying){
+			delete_t(i);
 			break;
 		}
 	}
+	dying = NULL;
+}
 
-	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
-	if(cur == -1){
-		threads[ready_t].state = running;
-		setcontext(&(threads[ready_t].ctx));
+// entry point of every spawned thread
+void start_thread(){
+	void (*start)() = threads[get_index()]->start;
+
+	reap_dying(); // the thread may have been switched to by a dying thread
+
+#ifndef STHREADS_NO_PREEMPT
+	// the thread is switched to with the timer signal blocked
+	sigset_t block;
+	sigemptyset(&block);
+	sigaddset(&block, timer_signal(TIMER_TYPE));
+	sigprocmask(SIG_UNBLOCK, &block, NULL);
+#endif
+
+	start();
+	done();
+}
+
+void schedule(){
+	// for(int i=0; i<t_num; i++){
+	// 	printf("threads[%d].state: %u\n", i, threads[i]->state);
+	// }
+	// printf("schedule\n");
+
+#ifndef STHREADS_NO_PREEMPT
+	// the timer signal must not preempt the thread switch. Every thread is
+	// switched to with the signal blocked and unblocks it when it continues.
+	sigset_t block;
+	sigemptyset(&block);
+	sigaddset(&block, timer_signal(TIMER_TYPE));
+	sigprocmask(SIG_BLOCK, &block, NULL);
+#endif
+
+	wake_threads();
+
+	thread_t *prev = current;
+#if STHREADS_INSTRUMENT
+	long switched = now_ns();
+	if(prev != NULL){
+		prev->run_ns += switched - prev->run_start;
+	}
+#endif
+	if(prev != NULL && prev->state == running){
+		// the running thread continues if the policy picks it again
+		prev->state = ready;
+		policy->enqueue(prev);
+	}
+	else if(prev != NULL){
+		policy->on_block(prev);
+	}
+
+	thread_t *next = policy->pick_next();
+	if(next == NULL){
+		// no thread can run, sleep until one is woken up
+		next = idle();
+#if STHREADS_INSTRUMENT
+		switched = now_ns();
+#endif
 	}
-	else if(ready_t == -1){
+#if STHREADS_INSTRUMENT
+	next->run_start = switched;
+#endif
+
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+	next->state = running;
+	current = next;
+	if(next == prev){
 		// if there is no other thread to run, run the current thread
 	}
-	else{ // there is thread running
-		threads[cur].state = ready;
-		threads[ready_t].state = running;
-		//printf("til now: %d from now: %d\n", cur, ready_t);
+	else if(prev == NULL){
+#ifndef STHREADS_NO_PREEMPT
+		sigaddset(&(next->ctx.uc_sigmask), timer_signal(TIMER_TYPE));
+#endif
+		setcontext(&(next->ctx));
+	}
+	else{ // a waiting thread resumes here once the policy picks it again
+#ifndef STHREADS_NO_PREEMPT
+		sigaddset(&(next->ctx.uc_sigmask), timer_signal(TIMER_TYPE));
+#endif
+		//printf("til now: %d from now: %d\n", prev->tid, next->tid);
 		
-		if (swapcontext(&(threads[cur].ctx), &(threads[ready_t].ctx)) < 0) {
+		if (swapcontext(&(prev->ctx), &(next->ctx)) < 0) {
 			perror("swapcontext");
 			exit(EXIT_FAILURE);
 		}
 	}
+	reap_dying();
+#ifndef STHREADS_NO_PREEMPT
+	sigprocmask(SIG_UNBLOCK, &block, NULL);
+#endif
+}
+
+// t can run again, hand it to the scheduling policy
+void make_ready(thread_t * t){
+	if(t->state != waiting){
+		return;
+	}
+	policy->on_wake(t);
+	t->state = ready;
+	policy->enqueue(t);
+}
+
+// the running thread used up its time slice
+void preempt(){
+	if(policy->on_tick(current)){
+		schedule();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+	}
 }
 
 void delete_t(int index){
 	//printf("delete_t\n");
-	free(threads[index].ctx.uc_stack.ss_sp);
+	free_thread(threads[index]);
 
 	for(int i=index; i<t_num-1; i++){
 		threads[i] = threads[i+1];
@@ -149,24 +412,226 @@ void delete_t(int index){
 
 
 	t_num--;
-	threads = (thread_t*) realloc(threads, sizeof(thread_t)*t_num);
-	if(threads == 0x0){
+#if STHREADS_MAX_THREADS == 0
+	threads = (thread_t**) realloc(threads, sizeof(thread_t*)*t_num);
+	if(threads == 0x0 && t_num > 0){
 		perror("delete thread");
 		exit(EXIT_FAILURE);
 	}
+#endif
 }
 
 int get_index(){
 	for(int i=0; i<t_num; i++){
-		if(threads[i].state == running){
+		if(threads[i]->state == running){
+			return i;
+		}
+	}
+	return -1;
+}
+
+int find_index(tid_t tid){
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->tid == tid){
 			return i;
 		}
 	}
 	return -1;
 }
 
+long now_us(){
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0){
+		perror("clock_gettime");
+		exit(EXIT_FAILURE);
+	}
+
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+long now_ns(){
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0){
+		perror("clock_gettime");
+		exit(EXIT_FAILURE);
+	}
+
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// make threads whose sleep timed out or who were unparked ready
+void wake_threads(){
+	// drain the st_unpark() requests
+	while(inject_head != __atomic_load_n(&inject_tail, __ATOMIC_ACQUIRE)){
+		unsigned slot = inject_head % INJECT_SIZE;
+		tid_t tid = __atomic_load_n(&inject[slot], __ATOMIC_ACQUIRE);
+		if(tid == 0){ // the slot is claimed but not written yet
+			break;
+		}
+		inject[slot] = 0;
+		__atomic_store_n(&inject_head, inject_head+1, __ATOMIC_RELEASE);
+
+		int index = find_index(tid);
+		if(index < 0 || threads[index]->state == terminated){
+			continue;
+		}
+		if(threads[index]->parked > 0){
+			threads[index]->parked = 0;
+			make_ready(threads[index]);
+			parkers--;
+		}
+		else{ // unparked before it parked, the next st_park() returns at once
+			threads[index]->parked = -1;
+		}
+	}
+
+	if(sleepers == 0){
+		return;
+	}
+
+	long now = now_us();
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->wake >= 0 && threads[i]->wake <= now){
+			threads[i]->wake = -1;
+			make_ready(threads[i]);
+			sleepers--;
+		}
+	}
+}
+
+/* Called by schedule() when no thread is ready and the calling thread can not
+   continue. Sleeps in sigsuspend() until a sleeping thread times out or a thread
+   is unparked and returns the thread to run. When all threads wait
+   for a mutex, cond_t, sem_t or join() nothing can wake them and the program is
+   terminated.
+*/
+thread_t * idle(){
+	sigset_t block, old, suspend;
+
+	sigemptyset(&block);
+	sigaddset(&block, WAKE_SIGNAL);
+#ifndef STHREADS_NO_PREEMPT
+	sigaddset(&block, timer_signal(TIMER_TYPE));
+#endif
+	sigprocmask(SIG_BLOCK, &block, &old);
+	suspend = old;
+	sigdelset(&suspend, WAKE_SIGNAL);
+#ifndef STHREADS_NO_PREEMPT
+	sigdelset(&suspend, timer_signal(TIMER_TYPE));
+#endif
+
+	// set before checking for work so that st_unpark() knows to send WAKE_SIGNAL
+	__atomic_store_n(&idling, 1, __ATOMIC_SEQ_CST);
+	while(true){
+		wake_threads();
+		thread_t *next = policy->pick_next();
+		if(next != NULL){
+			__atomic_store_n(&idling, 0, __ATOMIC_SEQ_CST);
+			sigprocmask(SIG_SETMASK, &old, NULL);
+			return next;
+		}
+
+		if(sleepers == 0 && parkers == 0){
+			fprintf(stderr, "[ERROR] deadlock - all threads are waiting and none can be woken up\n");
+			exit(EXIT_FAILURE);
+		}
+
+		long wake = -1; // us until the first sleeping thread times out
+		if(sleepers > 0){
+			for(int i=0; i<t_num; i++){
+				if(threads[i]->wake >= 0 && (wake < 0 || threads[i]->wake < wake)){
+					wake = threads[i]->wake;
+				}
+			}
+			wake -= now_us();
+			wake = wake > 0 ? wake : 1;
+		}
+
+#ifndef STHREADS_NO_PREEMPT
+		if(wake > 0){
+			set_timer(TIMER_TYPE, timer_handler, wake);
+		}
+		sigsuspend(&suspend);
+#else
+		// without a timer, wait for WAKE_SIGNAL with a timeout instead
+		struct timespec timeout = {wake / 1000000, wake % 1000000 * 1000};
+		pselect(0, NULL, NULL, NULL, wake > 0 ? &timeout : NULL, &suspend);
+#endif
+	}
+}
+
+// free the arena chunks of t allocated with malloc()
+void arena_release(thread_t * t){
+	while(t->chunks != NULL){
+		arena_chunk_t *chunk = t->chunks;
+		t->chunks = chunk->next;
+		free(chunk);
+	}
+	t->arena = t->arena_base;
+	t->arena_end = t->arena_base == NULL ? NULL : t->arena_base + ARENA_SIZE;
+}
+
+// entry point of threads created by spawn_future()
+void start_future(){
+	future_t *f = current->arg;
+
+	future_exit(f->fn(f->arg));
+}
+
+// suspend the running thread until wg->count drops to 0, the timer must be stopped
+void wg_park(waitgroup_t * wg){
+	wg->waiter = current;
+	current->wg = wg;
+	current->state = waiting;
+
+	// save the context
+	if(getcontext(&(current->ctx)) < 0){
+		perror("getcontext");
+		exit(EXIT_FAILURE);
+	}
+
+	schedule();
+}
+
+// count down wg and make its waiter ready at 0, the timer must be stopped
+void wg_release(waitgroup_t * wg){
+	wg->count--;
+	if(wg->count == 0 && wg->waiter != NULL){
+		wg->waiter->wg = NULL;
+		make_ready(wg->waiter);
+		wg->waiter = NULL;
+	}
+}
+
+// runs st_blocking() calls on a kernel thread of its own
+void *blocking_helper(void *unused){
+	while(true){
+		pthread_mutex_lock(&b_mutex);
+		while(b_count == 0){
+			pthread_cond_wait(&b_cond, &b_mutex);
+		}
+		blocking_call_t *call = b_queue[b_head];
+		b_head = (b_head + 1) % b_size;
+		b_count--;
+		pthread_mutex_unlock(&b_mutex);
+
+		// call lives on the caller's stack, which may be gone once done is set
+		tid_t tid = call->tid;
+		call->result = call->fn(call->arg);
+		__atomic_store_n(&call->done, 1, __ATOMIC_RELEASE);
+		while(st_unpark(tid) < 0){ // the injection queue is full
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
 /*		------------------ Timer Functions ------------------		*/
 
+#ifndef STHREADS_NO_PREEMPT
+
 int timer_signal(int timer_type){
 	int sig;
 
@@ -188,17 +653,15 @@ int timer_signal(int timer_type){
 	return sig;
 }
 
-void set_timer(int type, void (*handler)(int), int us){
+// handler is installed once by init()
+void set_timer(int type, void (*handler)(int), long us){
 	struct itimerval timer;
-	struct sigaction sa;
 
-	memset(&sa, 0, sizeof(sa));			// make all sa memory space to 0
-	sa.sa_handler = handler;			// assign handler
-	sigaction(timer_signal(type), &sa, NULL);	// install signal handler
+	in_api = 0;
 	
 	// after which second the timer will alarm the program
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = us;
+	timer.it_value.tv_sec = us / 1000000;
+	timer.it_value.tv_usec = us % 1000000;
 	// the gap between alarms (0 means don't repeat timer)
 	timer.it_interval.tv_sec = 0;
 	timer.it_interval.tv_usec = 0;
@@ -212,11 +675,10 @@ void set_timer(int type, void (*handler)(int), int us){
 int stop_timer(int type, void (*handler)(int)){
 	struct itimerval timer;
 	struct itimerval remain;
-	struct sigaction sa;
 
-	memset(&sa, 0, sizeof(sa));			// make all sa memory space to 0
-	sa.sa_handler = handler;			// assign handler
-	sigaction(timer_signal(type), &sa, NULL);	// install signal handler
+	// a signal that is already pending may still arrive after the timer is
+	// stopped, timer_handler() ignores it
+	in_api = 1;
 	
 	// after which second the timer will alarm the program
 	timer.it_value.tv_sec = 0;
@@ -234,148 +696,708 @@ int stop_timer(int type, void (*handler)(int)){
 }
 
 void timer_handler(int signum){
-	printf("timer\n");
+	// printf("timer\n");
+	if(idling || in_api){ // only interrupts sigsuspend() in idle() or arrived late
+		return;
+	}
 	// stop timer and schedule a new thread
 	stop_timer(TIMER_TYPE, timer_handler);
-	schedule();
+	preempt();
 }
 
+#endif
 
 
-/*		------------------ Queue Functions ------------------		*/
 
-/*void queue_init(queue_t * q){
+void wake_handler(int signum){
+	// nothing to do, receiving the signal makes sigsuspend() in idle() return
+}
 
-}*/
+/*		------------------ Scheduling Policies ------------------		*/
+
+void rq_push(thread_t * t){
+	t->next = NULL;
+	if(rq_tail == NULL){
+		rq_head = t;
+	}
+	else{
+		rq_tail->next = t;
+	}
+	rq_tail = t;
+}
 
+// removes t from the run queue, prev is the thread before it (NULL if t is the head)
+thread_t * rq_unlink(thread_t * prev, thread_t * t){
+	if(prev == NULL){
+		rq_head = t->next;
+	}
+	else{
+		prev->next = t->next;
+	}
+	if(rq_tail == t){
+		rq_tail = prev;
+	}
+	t->next = NULL;
+	return t;
+}
 
+thread_t * rq_pop(){
+	if(rq_head == NULL){
+		return NULL;
+	}
+	return rq_unlink(NULL, rq_head);
+}
 
-/*******************************************************************************
-                    Implementation of the Simple Threads API
-********************************************************************************/
+void no_hook(thread_t * t){
+}
 
+int never_preempt(thread_t * t){
+	return 0;
+}
 
-int  init(){
-	t_num++;
-	threads = (thread_t *) malloc(sizeof(thread_t)*t_num);
-	if(threads == NULL){
-		return -1;
-	}
+int always_preempt(thread_t * t){
+	return 1;
+}
 
-	// thread for main
-	threads[t_num-1].tid = t_num;
-	threads[t_num-1].state = ready;
-	threads[t_num-1].next = NULL;
-	threads[t_num-1].mid = -1;
-	threads[t_num-1].cid = -1;
-	threads[t_num-1].sid = -1;
-	// get main info and initialize it in the thread structure
-	if(getcontext(&(threads[t_num-1].ctx)) < 0){
-		perror("getcontext");
-		exit(EXIT_FAILURE);
+// the thread with the smallest pass runs next, first in queue order on ties
+thread_t * stride_pick_next(){
+	thread_t *best = NULL, *best_prev = NULL;
+	for(thread_t *prev = NULL, *t = rq_head; t != NULL; prev = t, t = t->next){
+		if(best == NULL || t->pass < best->pass){
+			best = t;
+			best_prev = prev;
+		}
 	}
+	if(best == NULL){
+		return NULL;
+	}
+	stride_pass = best->pass;
+	best->pass += STRIDE1 / best->prio;
+	return rq_unlink(best_prev, best);
+}
 
-	schedule();
+// a thread that was waiting must not catch up on the time it did not run
+void stride_on_wake(thread_t * t){
+	if(t->pass < stride_pass){
+		t->pass = stride_pass;
+	}
+}
 
-	return 1;
+// the thread with the highest prio runs next, first in queue order on ties
+thread_t * priority_pick_next(){
+	thread_t *best = NULL, *best_prev = NULL;
+	for(thread_t *prev = NULL, *t = rq_head; t != NULL; prev = t, t = t->next){
+		if(best == NULL || t->prio > best->prio){
+			best = t;
+			best_prev = prev;
+		}
+	}
+	if(best == NULL){
+		return NULL;
+	}
+	return rq_unlink(best_prev, best);
 }
 
+const sched_policy_t sched_fifo = {"fifo", rq_push, rq_pop, no_hook, no_hook, never_preempt};
+const sched_policy_t sched_rr = {"rr", rq_push, rq_pop, no_hook, no_hook, always_preempt};
+const sched_policy_t sched_stride = {"stride", rq_push, stride_pick_next, no_hook, stride_on_wake, always_preempt};
+const sched_policy_t sched_priority = {"priority", rq_push, priority_pick_next, no_hook, no_hook, always_preempt};
 
-tid_t spawn(void (*start)()){
-	// printf("spawn\n");
+/*		------------------ Lock Statistics ------------------		*/
 
-	// make space for new thread
-	t_num++;
-	threads = (thread_t *) realloc(threads, sizeof(thread_t)*t_num);
-	
-	if(threads == NULL){
-		perror("realloc");
+// returns NULL when statistics are disabled
+lockstat_t * lockstat_new(const char *kind, int id, const char *label){
+	if(!STHREADS_INSTRUMENT || !lockstat_on){
+		return NULL;
+	}
+	// malloc() is not reentrant, stop the timer unless the caller already did
+	int stopped = in_api;
+	int usec = stopped ? 0 : stop_timer(TIMER_TYPE, timer_handler);
+	lockstat_t *ls = (lockstat_t *) calloc(1, sizeof(lockstat_t));
+	if(ls == NULL){
+		perror("calloc");
 		exit(EXIT_FAILURE);
 	}
+	ls->kind = kind;
+	ls->id = id;
+	ls->label = label;
+	ls->next = lockstats;
+	lockstats = ls;
+	if(!stopped){
+		set_timer(TIMER_TYPE, timer_handler, usec == 0 ? TIMEOUT : usec);
+	}
+	return ls;
+}
 
-	// set thread structure
-	init_thread(&(threads[t_num-1]), start);
-	
-	/*for(int i=0; i<t_num; i++){
-		if(threads[i].state == running){ // if another thread is running, just return the thread id
-			return threads[t_num-1].tid;
-		}
-	}*/
+// the caller acquired the primitive, start is the time it began to wait (-1 if it did not)
+void lockstat_acquire(lockstat_t * ls, long start){
+	long now = now_ns();
+	ls->acquires++;
+	ls->hold_start = now;
+	if(start < 0){
+		return;
+	}
 
-	schedule();
+	long wait = now - start;
+	ls->contended++;
+	ls->wait_total += wait;
+	if(wait > ls->wait_max){
+		ls->wait_max = wait;
+	}
+	int bucket = wait > 0 ? 63 - __builtin_clzl(wait) : 0;
+	if(bucket >= ST_HIST_BUCKETS){
+		bucket = ST_HIST_BUCKETS - 1;
+	}
+	ls->hist[bucket]++;
+}
 
-	return threads[t_num-1].tid;
+// the holder released the mutex
+void lockstat_release(lockstat_t * ls){
+	long hold = now_ns() - ls->hold_start;
+	ls->hold_total += hold;
+	if(hold > ls->hold_max){
+		ls->hold_max = hold;
+	}
 }
 
-void yield(){
-	stop_timer(TIMER_TYPE, timer_handler);
-	schedule();
+int lockstat_cmp(const void *a, const void *b){
+	long wa = (*(lockstat_t **) a)->wait_total;
+	long wb = (*(lockstat_t **) b)->wait_total;
+	return wa < wb ? 1 : (wa > wb ? -1 : 0);
+}
 
+void lockstat_exit(){
+	st_lockstat_dump(stderr);
 }
 
-void  done(){
-	// running -> terminated & save thread id of the terminated thread
-	for(int i=0; i<t_num; i++){
-		if(threads[i].state == running){
-			threads[i].state = terminated;
-			termin = threads[i].tid;
-			break;
-		}
-	}
+/*		------------------ Sampling Profiler ------------------		*/
 
-	// make all waiting threads to ready
-	for(int i=0; i<t_num; i++){
-		if(threads[i].state == waiting && threads[i].mid < 0 && threads[i].cid < 0){
-			threads[i].state = ready;
-		}
+#if STHREADS_INSTRUMENT
+
+/* SIGPROF handler. Claims a sample slot with an atomic increment so it never
+   blocks and may interrupt any code, including the scheduler. The timer signal
+   is blocked while it runs so the thread can not be switched mid-sample.
+*/
+void prof_handler(int signum, siginfo_t *info, void *uc){
+	unsigned i = __atomic_fetch_add(&prof_next, 1, __ATOMIC_RELAXED);
+	if(i >= PROF_SAMPLES){
+		return;
 	}
 
-	// schedule another thread
-	stop_timer(TIMER_TYPE, timer_handler);
-	schedule();
+	prof_sample_t *sample = &prof_samples[i];
+	thread_t *t = current;
+	sample->tid = t != NULL ? t->tid : 0;
+	sample->start = t != NULL ? t->start : NULL;
+	sample->depth = prof_backtrace((ucontext_t *) uc, t, sample->pc);
+	__atomic_store_n(&sample->valid, 1, __ATOMIC_RELEASE);
 }
 
-tid_t join() {
-	for(int i=0; i<t_num; i++){
-		if(threads[i].state == running){
-			threads[i].state = waiting;
-			stop_timer(TIMER_TYPE, timer_handler);
-			
-			// save the context
-			if(getcontext(&(threads[i].ctx)) < 0){
-				perror("getcontext");
-				exit(EXIT_FAILURE);
-			}
+/* Walks the frame pointer chain of the interrupted code, needs
+   -fno-omit-frame-pointer. Code compiled without frame pointers uses the
+   register for other data, so every frame must lie within the thread's stack.
+*/
+int prof_backtrace(ucontext_t *uc, thread_t *t, void **pc){
+#if defined(__linux__) && defined(__x86_64__)
+	void *ip = (void *) uc->uc_mcontext.gregs[REG_RIP];
+	void **fp = (void **) uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__linux__) && defined(__aarch64__)
+	void *ip = (void *) uc->uc_mcontext.pc;
+	void **fp = (void **) uc->uc_mcontext.regs[29];
+#else
+	void *ip = NULL;
+	void **fp = NULL;
+#endif
+	char *low = main_stack_low, *high = main_stack_high;
+	if(t != NULL && t->start != NULL){
+		low = (char *) t->ctx.uc_stack.ss_sp;
+		high = low + STACK_SIZE;
+	}
 
-			schedule();
+	int depth = 0;
+	if(ip != NULL){
+		pc[depth++] = ip;
+	}
+	while(depth < PROF_DEPTH && low != NULL && ((unsigned long) fp & (sizeof(void *) - 1)) == 0){
+		if((char *) fp < low || (char *) (fp + 2) > high || fp[1] == NULL){
 			break;
 		}
-	}
-
-	for(int i=0; i<t_num; i++){
-		if(threads[i].state == terminated){
-			delete_t(i);
+		pc[depth++] = fp[1];
+		if((void **) fp[0] <= fp){ // frames grow towards the stack base
 			break;
 		}
+		fp = (void **) fp[0];
 	}
+	return depth;
+}
 
-	return termin;
+int prof_cmp(const void *a, const void *b){
+	const prof_sample_t *sa = a, *sb = b;
+	if(sa->tid != sb->tid){
+		return sa->tid < sb->tid ? -1 : 1;
+	}
+	if(sa->depth != sb->depth){
+		return sa->depth < sb->depth ? -1 : 1;
+	}
+	return memcmp(sa->pc, sb->pc, sizeof(void *) * sa->depth);
 }
 
-void lock_init(mutex_t *m){
-	m_num++;
-	m->mid = m_num;
-	m->flag = 0;
+void prof_symbol(FILE *out, void *addr){
+	Dl_info info;
+	if(dladdr(addr, &info) && info.dli_sname != NULL){
+		fputs(info.dli_sname, out);
+	}
+	else{
+		fprintf(out, "%p", addr);
+	}
 }
 
-void lock(mutex_t * m){
-	int usec = stop_timer(TIMER_TYPE, timer_handler);
-	//printf("usec: %d\n", usec);
-	if(m->flag == 0){
-		// printf("hold lock\n");
-		m->flag = 1;
-		if(usec == 0){
+// writes one line per distinct stack: thread;start function;outermost;...;innermost count
+void prof_exit(){
+	struct itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_PROF, &off, NULL);
+	stop_timer(TIMER_TYPE, timer_handler);
+
+	unsigned n = prof_next < PROF_SAMPLES ? prof_next : PROF_SAMPLES;
+	unsigned valid = 0;
+	for(unsigned i=0; i<n; i++){
+		if(prof_samples[i].valid){
+			prof_samples[valid++] = prof_samples[i];
+		}
+	}
+	qsort(prof_samples, valid, sizeof(prof_sample_t), prof_cmp);
+
+	FILE *out = fopen(prof_path, "w");
+	if(out == NULL){
+		perror(prof_path);
+		return;
+	}
+	for(unsigned i=0; i<valid; ){
+		unsigned j = i + 1;
+		while(j < valid && prof_cmp(&prof_samples[i], &prof_samples[j]) == 0){
+			j++;
+		}
+		prof_sample_t *sample = &prof_samples[i];
+		fprintf(out, "sthread-%d;", sample->tid);
+		if(sample->start != NULL){
+			prof_symbol(out, (void *) sample->start);
+		}
+		else{
+			fputs("main", out);
+		}
+		for(int d=sample->depth-1; d>=0; d--){
+			fputc(';', out);
+			prof_symbol(out, sample->pc[d]);
+		}
+		fprintf(out, " %u\n", j - i);
+		i = j;
+	}
+	fclose(out);
+	if(prof_next > PROF_SAMPLES){
+		fprintf(stderr, "[WARNING] profiler dropped %u samples\n", prof_next - PROF_SAMPLES);
+	}
+}
+
+#endif
+
+/*		------------------ Introspection ------------------		*/
+
+// fills info for t, does not allocate so that st_dump() can use it in a signal handler
+void thread_info(thread_t * t, st_thread_info_t * info){
+	info->tid = t->tid;
+	info->state = t->state;
+	info->start = t->start;
+	info->object = -1;
+	info->blocked_on = st_on_none;
+	if(t->state == waiting){
+		if(t->cid >= 0){
+			info->blocked_on = st_on_cond;
+			info->object = t->cid;
+		}
+		else if(t->mid >= 0){
+			info->blocked_on = st_on_mutex;
+			info->object = t->mid;
+		}
+		else if(t->sid >= 0){
+			info->blocked_on = st_on_sem;
+			info->object = t->sid;
+		}
+		else if(t->wake >= 0){
+			info->blocked_on = st_on_sleep;
+		}
+		else if(t->parked > 0){
+			info->blocked_on = st_on_park;
+		}
+		else if(t->wg != NULL){
+			info->blocked_on = st_on_waitgroup;
+		}
+		else{
+			info->blocked_on = st_on_join;
+		}
+	}
+
+	info->run_ns = t->run_ns;
+#if STHREADS_INSTRUMENT
+	if(t == current){
+		info->run_ns += now_ns() - t->run_start;
+	}
+#else
+	info->run_ns = 0;
+#endif
+
+	// the stack grows down from high, the stack pointer of a thread that is
+	// not running was saved in its context
+	char *low = main_stack_low, *high = main_stack_high;
+	if(t->start != NULL){
+		low = (char *) t->ctx.uc_stack.ss_sp;
+		high = low + STACK_SIZE;
+	}
+	char *sp = NULL;
+	if(t == current){
+		sp = (char *) &sp;
+	}
+	else{
+#if defined(__linux__) && defined(__x86_64__)
+		sp = (char *) t->ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__linux__) && defined(__aarch64__)
+		sp = (char *) t->ctx.uc_mcontext.sp;
+#endif
+	}
+	info->stack_size = high - low;
+	info->stack_used = low != NULL && sp > low && sp <= high ? high - sp : 0;
+}
+
+// appends s to buf, right aligned in width characters
+void dump_str(char *buf, int *len, const char *s, int width){
+	int n = strlen(s);
+	for(; n < width; width--){
+		buf[(*len)++] = ' ';
+	}
+	while(*s != '\0'){
+		buf[(*len)++] = *s++;
+	}
+}
+
+// appends the decimal value to buf, right aligned in width characters
+void dump_num(char *buf, int *len, long value, int width){
+	char digits[24];
+	int n = sizeof(digits) - 1;
+	digits[n] = '\0';
+	int negative = value < 0;
+	do{
+		digits[--n] = '0' + (negative ? -(value % 10) : value % 10);
+		value /= 10;
+	} while(value != 0);
+	if(negative){
+		digits[--n] = '-';
+	}
+	dump_str(buf, len, digits + n, width);
+}
+
+void dump_handler(int signum){
+	st_dump(STDERR_FILENO);
+}
+
+
+/*void queue_init(queue_t * q){
+
+}*/
+
+
+
+/*******************************************************************************
+                    Implementation of the Simple Threads API
+********************************************************************************/
+
+
+int  init(){
+	const sched_policy_t *policies[] = {&sched_fifo, &sched_rr, &sched_stride, &sched_priority};
+	const char *name = getenv("STHREADS_POLICY");
+	if(name == NULL){
+		return init_policy(&STHREADS_DEFAULT_POLICY);
+	}
+	for(int i=0; i<(int)(sizeof(policies)/sizeof(policies[0])); i++){
+		if(strcmp(name, policies[i]->name) == 0){
+			return init_policy(policies[i]);
+		}
+	}
+	fprintf(stderr, "[ERROR] unknown STHREADS_POLICY %s\n", name);
+	return -1;
+}
+
+int init_policy(const sched_policy_t *p){
+	policy = p;
+	if(getenv("STHREADS_LOCKSTAT") != NULL){
+		st_lockstat_enable(1);
+	}
+	if(getenv("STHREADS_PROF") != NULL && st_prof_start(getenv("STHREADS_PROF"), PROF_HZ) < 0){
+		return -1;
+	}
+	if(getenv("STHREADS_DUMP") != NULL && st_dump_on_signal(SIGUSR1) < 0){
+		return -1;
+	}
+
+#ifdef __linux__
+	// main's stack for the profiler and st_snapshot()
+	pthread_attr_t attr;
+	void *stack;
+	size_t size;
+	if(pthread_getattr_np(pthread_self(), &attr) == 0){
+		if(pthread_attr_getstack(&attr, &stack, &size) == 0){
+			main_stack_low = (char *) stack;
+			main_stack_high = main_stack_low + size;
+		}
+		pthread_attr_destroy(&attr);
+	}
+#endif
+	t_num++;
+#if STHREADS_MAX_THREADS == 0
+	threads = (thread_t **) malloc(sizeof(thread_t*)*t_num);
+	if(threads == NULL){
+		return -1;
+	}
+#endif
+	threads[t_num-1] = (thread_t *) malloc(sizeof(thread_t));
+	if(threads[t_num-1] == NULL){
+		return -1;
+	}
+
+	// thread for main
+	threads[t_num-1]->tid = ++t_last;
+	threads[t_num-1]->state = running; // main is the running thread
+	current = threads[t_num-1];
+	threads[t_num-1]->start = NULL;
+	threads[t_num-1]->next = NULL;
+	threads[t_num-1]->mid = -1;
+	threads[t_num-1]->cid = -1;
+	threads[t_num-1]->sid = -1;
+	threads[t_num-1]->wake = -1;
+	threads[t_num-1]->parked = 0;
+	threads[t_num-1]->prio = 1;
+	threads[t_num-1]->pass = 0;
+	threads[t_num-1]->wg = NULL;
+	threads[t_num-1]->detached = 0;
+	threads[t_num-1]->arg = NULL;
+	// main has no region of its own, its arena is allocated on demand
+	threads[t_num-1]->arena_base = NULL;
+	threads[t_num-1]->arena = NULL;
+	threads[t_num-1]->arena_end = NULL;
+	threads[t_num-1]->chunks = NULL;
+	memset(threads[t_num-1]->tls, 0, sizeof(threads[t_num-1]->tls));
+	threads[t_num-1]->run_ns = 0;
+	threads[t_num-1]->run_start = now_ns();
+
+	// st_unpark() interrupts idle() with WAKE_SIGNAL
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = wake_handler;
+	sigaction(WAKE_SIGNAL, &sa, NULL);
+
+#ifndef STHREADS_NO_PREEMPT
+	sa.sa_handler = timer_handler;
+	sigaction(timer_signal(TIMER_TYPE), &sa, NULL);
+#endif
+
+	// get main info and initialize it in the thread structure
+	if(getcontext(&(threads[t_num-1]->ctx)) < 0){
+		perror("getcontext");
+		exit(EXIT_FAILURE);
+	}
+
+	schedule();
+
+	return 1;
+}
+
+
+tid_t spawn(void (*start)()){
+	return spawn_thread(start, NULL, 0);
+}
+
+tid_t spawn_detached(void (*start)()){
+	return spawn_thread(start, NULL, 1);
+}
+
+tid_t spawn_thread(void (*start)(), void *arg, int detached){
+	// printf("spawn\n");
+	stop_timer(TIMER_TYPE, timer_handler);
+
+	// make space for new thread
+#if STHREADS_MAX_THREADS > 0
+	if(t_num == STHREADS_MAX_THREADS){
+		set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+		return -1;
+	}
+	t_num++;
+#else
+	t_num++;
+	threads = (thread_t **) realloc(threads, sizeof(thread_t*)*t_num);
+	
+	if(threads == NULL){
+		perror("realloc");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	threads[t_num-1] = alloc_thread();
+
+	// set thread structure
+	init_thread(threads[t_num-1], start);
+	threads[t_num-1]->arg = arg;
+	threads[t_num-1]->detached = detached;
+	tid_t tid = threads[t_num-1]->tid;
+	policy->on_wake(threads[t_num-1]);
+	policy->enqueue(threads[t_num-1]);
+	
+	/*for(int i=0; i<t_num; i++){
+		if(threads[i]->state == running){ // if another thread is running, just return the thread id
+			return threads[t_num-1]->tid;
+		}
+	}*/
+
+	schedule();
+
+	return tid;
+}
+
+void yield(){
+	stop_timer(TIMER_TYPE, timer_handler);
+	schedule();
+
+}
+
+int detach(tid_t tid){
+	stop_timer(TIMER_TYPE, timer_handler);
+	int index = find_index(tid);
+	if(index >= 0 && threads[index]->state == terminated && !threads[index]->detached){
+		delete_t(index); // already terminated, nobody can join it any more
+	}
+	else if(index >= 0){
+		threads[index]->detached = 1;
+	}
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+	return index >= 0 ? 0 : -1;
+}
+
+int st_setprio(tid_t tid, int prio){
+	if(prio < 1){
+		return -1;
+	}
+	stop_timer(TIMER_TYPE, timer_handler);
+	int index = find_index(tid);
+	if(index >= 0){
+		threads[index]->prio = prio;
+	}
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+	return index >= 0 ? 0 : -1;
+}
+
+void  done(){
+	// destructors run before the thread terminates, they may use the API
+	for(int key=0; key<k_num; key++){
+		void *value = current->tls[key];
+		if(value != NULL && destructors[key] != NULL){
+			current->tls[key] = NULL;
+			destructors[key](value);
+		}
+	}
+
+	stop_timer(TIMER_TYPE, timer_handler);
+
+	// a detached thread is deleted by the next thread to run, nobody joins it
+	if(current->detached){
+		current->state = terminated;
+		dying = current;
+		schedule();
+	}
+
+	// running -> terminated & save thread id of the terminated thread
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->state == running){
+			threads[i]->state = terminated;
+			termin = threads[i]->tid;
+			arena_release(threads[i]);
+			break;
+		}
+	}
+
+	// make all waiting threads to ready
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->state == waiting && threads[i]->mid < 0 && threads[i]->cid < 0
+			&& threads[i]->sid < 0 && threads[i]->wake < 0 && threads[i]->parked <= 0
+			&& threads[i]->wg == NULL){
+			make_ready(threads[i]);
+		}
+	}
+
+	// schedule another thread
+	schedule();
+}
+
+tid_t join() {
+	stop_timer(TIMER_TYPE, timer_handler);
+	// a thread that terminated before join() was called is joined without waiting
+	int finished = 0;
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->state == terminated && !threads[i]->detached){
+			finished = 1;
+			termin = threads[i]->tid;
+			break;
+		}
+	}
+	for(int i=0; i<t_num && !finished; i++){
+		if(threads[i]->state == running){
+			threads[i]->state = waiting;
+			
+			// save the context
+			if(getcontext(&(threads[i]->ctx)) < 0){
+				perror("getcontext");
+				exit(EXIT_FAILURE);
+			}
+
 			schedule();
+			break;
+		}
+	}
+
+	// the thread table must not change under a preempting schedule()
+	stop_timer(TIMER_TYPE, timer_handler);
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->state == terminated && !threads[i]->detached){
+			delete_t(i);
+			break;
+		}
+	}
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+
+	return termin;
+}
+
+void lock_init(mutex_t *m){
+	lock_init_label(m, NULL);
+}
+
+void lock_init_label(mutex_t * m, const char *label){
+	m_num++;
+	m->mid = m_num;
+	m->flag = 0;
+	m->stat = lockstat_new("mutex", m->mid, label);
+}
+
+void lock(mutex_t * m){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	//printf("usec: %d\n", usec);
+	if(m->mid == 0){ // all zero, initialize on first use
+		lock_init(m);
+	}
+	if(m->flag == 0){
+		// printf("hold lock\n");
+		m->flag = 1;
+		if(STAT_ON(m->stat)){
+			lockstat_acquire(m->stat, -1);
+		}
+		if(usec == 0){
+			preempt();
 		}
 		else{
 			set_timer(TIMER_TYPE, timer_handler, usec);
@@ -383,33 +1405,62 @@ void lock(mutex_t * m){
 	}
 	else {
 		// printf("\tlock held sleep\n");
+		long start = STAT_ON(m->stat) ? now_ns() : 0;
 		int index = get_index();
-		threads[index].mid = m->mid;
-		threads[index].state = waiting;
+		threads[index]->mid = m->mid;
+		threads[index]->state = waiting;
 
 		// save the context
-		if(getcontext(&(threads[index].ctx)) < 0 ){
+		if(getcontext(&(threads[index]->ctx)) < 0 ){
 			perror("getcontext");
 			exit(EXIT_FAILURE);
 		}
 
 		schedule();
+		// unlock() handed the mutex over to this thread
+		if(STAT_ON(m->stat)){
+			lockstat_acquire(m->stat, start);
+		}
+	}
+}
+
+int trylock(mutex_t * m){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	if(m->mid == 0){ // all zero, initialize on first use
+		lock_init(m);
+	}
+	int locked = m->flag == 0;
+	if(locked){
+		m->flag = 1;
+		if(STAT_ON(m->stat)){
+			lockstat_acquire(m->stat, -1);
+		}
+	}
+	if(usec == 0){
+		preempt();
 	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+	return locked ? 0 : -1;
 }
 
 void unlock(mutex_t * m){
 	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	if(STAT_ON(m->stat)){
+		lockstat_release(m->stat);
+	}
 	// printf("free lock\n");
 
 	// if there is a thread who wants this mutex
 	for(int i=0; i<t_num; i++){
-		if(threads[i].mid == m->mid){
+		if(threads[i]->mid == m->mid){
 			// printf("%d wanted this mutex\n", i);
-			threads[i].mid = -1;
-			threads[i].state = ready;
+			threads[i]->mid = -1;
+			make_ready(threads[i]);
 			// restart timer and resume timer
 			if(usec ==0){
-				schedule();
+				preempt();
 			}
 			else{
 				set_timer(TIMER_TYPE, timer_handler, usec);
@@ -420,7 +1471,7 @@ void unlock(mutex_t * m){
 	// printf("no thread wanted\n");
 	m->flag = 0;
 	if(usec ==0){
-		schedule();
+		preempt();
 	}
 	else{
 		set_timer(TIMER_TYPE, timer_handler, usec);
@@ -429,13 +1480,21 @@ void unlock(mutex_t * m){
 
 
 void cond_init(cond_t * c){
+	cond_init_label(c, NULL);
+}
+
+void cond_init_label(cond_t * c, const char *label){
 	c_num++;
 	c->cid = c_num;
-
+	c->m = 0x0;
+	c->stat = lockstat_new("cond", c->cid, label);
 }
 
 void cond_wait(cond_t * c, mutex_t * m){
 	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	if(c->cid == 0){ // all zero, initialize on first use
+		cond_init(c);
+	}
 
 	if(m->flag == 0){
 		perror("[ERROR] cond_wait mutex not held");
@@ -449,17 +1508,21 @@ void cond_wait(cond_t * c, mutex_t * m){
 	usec = stop_timer(TIMER_TYPE, timer_handler);
 	
 	int index = get_index();
-	threads[index].cid = c->cid;
-	threads[index].state = waiting;
+	long start = STAT_ON(c->stat) ? now_ns() : 0;
+	threads[index]->cid = c->cid;
+	threads[index]->state = waiting;
 	c->m = m;
 	
 	// save the context
-	if(getcontext(&(threads[index].ctx)) < 0 ){
+	if(getcontext(&(threads[index]->ctx)) < 0 ){
 		perror("getcontext");
 		exit(EXIT_FAILURE);
 	}
 
 	schedule();
+	if(STAT_ON(c->stat)){
+		lockstat_acquire(c->stat, start);
+	}
 
 	lock(m);
 }
@@ -467,10 +1530,13 @@ void cond_wait(cond_t * c, mutex_t * m){
 void cond_signal(cond_t *c){
 	int usec = stop_timer(TIMER_TYPE, timer_handler);
 	// printf("cond_signal\n");
+	if(c->cid == 0){ // all zero, initialize on first use
+		cond_init(c);
+	}
 	
 	if(c->m == 0x0){ // if there is no thread to wake up
 		if(usec == 0x0){
-			schedule();
+			preempt();
 		}
 		else{
 			set_timer(TIMER_TYPE, timer_handler, usec);
@@ -479,15 +1545,15 @@ void cond_signal(cond_t *c){
 	}
 
 	for(int i=0; i<t_num; i++){
-		if(threads[i].cid == c->cid){
+		if(threads[i]->cid == c->cid){
 			// there can be more than 1 threads waiting for this signal
 			// printf("%d was signaled\n", i);
 
-			threads[i].cid = -1;
-			threads[i].state = ready;
+			threads[i]->cid = -1;
+			make_ready(threads[i]);
 
 			if(usec == 0){
-				schedule();
+				preempt();
 			}
 			else{
 				set_timer(TIMER_TYPE, timer_handler, usec);
@@ -499,20 +1565,48 @@ void cond_signal(cond_t *c){
 	// printf("no thread was signaled\n");
 	c->m = 0x0;
 	if(usec == 0){
-		schedule();
+		preempt();
 	}
 	else{
 		set_timer(TIMER_TYPE, timer_handler, usec);
 	}
 }
 
-void sem_init(sem_t * s, int pshared, int value){
+void cond_broadcast(cond_t *c){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	if(c->cid == 0){ // all zero, initialize on first use
+		cond_init(c);
+	}
+
+	for(int i=0; i<t_num; i++){
+		if(threads[i]->cid == c->cid){
+			threads[i]->cid = -1;
+			make_ready(threads[i]);
+		}
+	}
+	c->m = 0x0;
+
+	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+}
+
+int sem_init(sem_t * s, int pshared, int value){
+	return sem_init_label(s, pshared, value, NULL);
+}
+
+int sem_init_label(sem_t * s, int pshared, int value, const char *label){
 	s_num++;
 	s->sid = s_num;
 	s->value = value;
+	s->stat = lockstat_new("sem", s->sid, label);
+	return 0;
 }
 
-void sem_wait(sem_t * s){
+int sem_wait(sem_t * s){
 	int usec = stop_timer(TIMER_TYPE, timer_handler);
 
 	s->value--;
@@ -520,27 +1614,36 @@ void sem_wait(sem_t * s){
 
 	// if the value is negative, wait
 	if(s->value < 0){
+		long start = STAT_ON(s->stat) ? now_ns() : 0;
 		int index = get_index();
-		threads[index].state = waiting;
-		threads[index].sid = s->sid;
+		threads[index]->state = waiting;
+		threads[index]->sid = s->sid;
 
-		if(getcontext(&(threads[index].ctx)) < 0){
+		if(getcontext(&(threads[index]->ctx)) < 0){
 			perror("getcontext");
 			exit(EXIT_FAILURE);
 		}
 
 		schedule();
+		if(STAT_ON(s->stat)){
+			lockstat_acquire(s->stat, start);
+		}
 	}
 	else{ // else continue execution
+		if(STAT_ON(s->stat)){
+			lockstat_acquire(s->stat, -1);
+		}
 		if(usec == 0){
-			schedule();
+			preempt();
 		}
 		else{
 			set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
 		}
 	}
+	return 0;
 }
-void sem_post(sem_t *s){
+
+int sem_post(sem_t *s){
 	int usec = stop_timer(TIMER_TYPE, timer_handler);
 
 	s->value++;
@@ -552,10 +1655,10 @@ void sem_post(sem_t *s){
 			s_ind = (s_ind+1) % t_num; // set the finding semaphore index of threads
 			// printf("s_ind: %d\n", s_ind);
 
-			if(threads[s_ind].sid == s->sid){
+			if(threads[s_ind]->sid == s->sid){
 				// printf("%d wanted this semaphore\n", s_ind);
-				threads[s_ind].state = ready;
-				threads[s_ind].sid = -1;
+				make_ready(threads[s_ind]);
+				threads[s_ind]->sid = -1;
 				break;
 			}
 		}
@@ -563,30 +1666,523 @@ void sem_post(sem_t *s){
 	
 	// continue execution
 	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+	return 0;
+}
+
+void st_sleep(long usec){
+	stop_timer(TIMER_TYPE, timer_handler);
+
+	int index = get_index();
+	threads[index]->wake = now_us() + usec;
+	threads[index]->state = waiting;
+	sleepers++;
+
+	// save the context
+	if(getcontext(&(threads[index]->ctx)) < 0){
+		perror("getcontext");
+		exit(EXIT_FAILURE);
+	}
+
+	schedule();
+}
+
+void st_park(){
+	stop_timer(TIMER_TYPE, timer_handler);
+	wake_threads();
+
+	int index = get_index();
+	if(threads[index]->parked < 0){ // already unparked
+		threads[index]->parked = 0;
 		schedule();
+		return;
+	}
+	threads[index]->parked = 1;
+	threads[index]->state = waiting;
+	parkers++;
+
+	// save the context
+	if(getcontext(&(threads[index]->ctx)) < 0){
+		perror("getcontext");
+		exit(EXIT_FAILURE);
+	}
+
+	schedule();
+}
+
+int st_unpark(tid_t tid){
+	unsigned tail;
+
+	// a 0 in the queue marks a claimed slot that is not written yet
+	if(tid <= 0){
+		return -1;
+	}
+
+	// claim a slot, fails when INJECT_SIZE requests are pending
+	do{
+		tail = __atomic_load_n(&inject_tail, __ATOMIC_SEQ_CST);
+		if(tail - __atomic_load_n(&inject_head, __ATOMIC_SEQ_CST) >= INJECT_SIZE){
+			return -1;
+		}
+	} while(!__atomic_compare_exchange_n(&inject_tail, &tail, tail+1, false,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	__atomic_store_n(&inject[tail % INJECT_SIZE], tid, __ATOMIC_RELEASE);
+
+	if(__atomic_load_n(&idling, __ATOMIC_SEQ_CST)){
+		kill(getpid(), WAKE_SIGNAL);
+	}
+	return 0;
+}
+
+void *st_alloc(size_t size){
+	thread_t *t = current;
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+	if(t->arena != NULL && size <= (size_t) (t->arena_end - t->arena)){
+		void *p = t->arena;
+		t->arena += size;
+		return p;
+	}
+
+	// the arena is full, continue in a new chunk
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+
+	size_t chunk_size = sizeof(arena_chunk_t) + ARENA_ALIGN + (size > ARENA_SIZE ? size : ARENA_SIZE);
+	arena_chunk_t *chunk = malloc(chunk_size);
+	void *p = NULL;
+	if(chunk != NULL){
+		chunk->next = t->chunks;
+		t->chunks = chunk;
+		t->arena = (char *) (((size_t) (chunk + 1) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1));
+		t->arena_end = (char *) chunk + chunk_size;
+		p = t->arena;
+		t->arena += size;
+	}
+
+	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+	return p;
+}
+
+void st_arena_reset(){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+
+	arena_release(current);
+
+	if(usec == 0){
+		preempt();
 	}
 	else{
 		set_timer(TIMER_TYPE, timer_handler, usec);
 	}
 }
 
+int st_key_create(st_key_t *key, void (*destructor)(void *)){
+	if(k_num == ST_KEYS_MAX){
+		return -1;
+	}
+	destructors[k_num] = destructor;
+	*key = k_num++;
+	return 0;
+}
+
+void *st_getspecific(st_key_t key){
+	return current->tls[key];
+}
+
+void st_setspecific(st_key_t key, void *value){
+	current->tls[key] = value;
+}
+
+future_t *spawn_future(void *(*fn)(void *), void *arg){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	future_t *f = malloc(sizeof(future_t));
+	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+	if(f == NULL){
+		return NULL;
+	}
+
+	f->fn = fn;
+	f->arg = arg;
+	f->result = NULL;
+	f->done = 0;
+	f->wg = NULL;
+	f->tid = spawn_thread(start_future, f, 0);
+	if(f->tid < 0){
+		stop_timer(TIMER_TYPE, timer_handler);
+		free(f);
+		set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+		return NULL;
+	}
+
+	return f;
+}
+
+void *future_get(future_t *f){
+	wait_all(&f, 1);
+	return f->result;
+}
+
+void future_exit(void *result){
+	if(current->start != start_future){
+		done();
+	}
+
+	future_t *f = current->arg;
+	stop_timer(TIMER_TYPE, timer_handler);
+	f->result = result;
+	f->done = 1;
+	if(f->wg != NULL){
+		wg_release(f->wg);
+	}
+	done();
+}
+
+void future_free(future_t *f){
+	stop_timer(TIMER_TYPE, timer_handler);
+
+	// reclaim the thread unless join() already did
+	int index = find_index(f->tid);
+	if(index >= 0 && threads[index]->state == terminated){
+		delete_t(index);
+	}
+	free(f);
+
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+}
+
+void wait_all(future_t **fs, int n){
+	waitgroup_t wg = {0, NULL};
 
+	stop_timer(TIMER_TYPE, timer_handler);
+	for(int i=0; i<n; i++){
+		if(!fs[i]->done){
+			fs[i]->wg = &wg;
+			wg.count++;
+		}
+	}
 
+	if(wg.count > 0){
+		wg_park(&wg);
+		stop_timer(TIMER_TYPE, timer_handler);
+		for(int i=0; i<n; i++){
+			fs[i]->wg = NULL;
+		}
+	}
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+}
 
+int wait_any(future_t **fs, int n){
+	waitgroup_t wg = {1, NULL};
 
+	stop_timer(TIMER_TYPE, timer_handler);
+	// nothing could release wg
+	if(fs == NULL || n <= 0){
+		set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+		return -1;
+	}
+	for(int i=0; i<n; i++){
+		if(fs[i]->done){
+			set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
+			return i;
+		}
+	}
 
+	// the first future to finish releases wg, the rest count it below 0
+	for(int i=0; i<n; i++){
+		fs[i]->wg = &wg;
+	}
+	wg_park(&wg);
+
+	stop_timer(TIMER_TYPE, timer_handler);
+	int first = -1;
+	for(int i=0; i<n; i++){
+		fs[i]->wg = NULL;
+		if(first < 0 && fs[i]->done){
+			first = i;
+		}
+	}
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
 
+	return first;
+}
 
+void wg_init(waitgroup_t * wg, int count){
+	wg->count = count;
+	wg->waiter = NULL;
+}
 
+void wg_add(waitgroup_t * wg, int n){
+	wg->count += n;
+}
 
+void wg_done(waitgroup_t * wg){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
 
+	wg_release(wg);
 
+	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+}
 
+void wg_wait(waitgroup_t * wg){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
 
+	if(wg->count > 0){
+		wg_park(wg);
+	}
+	else if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+}
 
+int st_blocking_init(int nthreads, int queue_size){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	int ret = 1;
 
+	if(b_size == 0){
+		b_queue = malloc(sizeof(blocking_call_t *) * queue_size);
+		if(b_queue == NULL){
+			ret = -1;
+		}
+		else{
+			// the helpers must not receive the timer signal or WAKE_SIGNAL
+			sigset_t all, old;
+			sigfillset(&all);
+			pthread_sigmask(SIG_SETMASK, &all, &old);
+			for(int i=0; i<nthreads; i++){
+				pthread_t helper;
+				if(pthread_create(&helper, NULL, blocking_helper, NULL) != 0){
+					perror("pthread_create");
+					exit(EXIT_FAILURE);
+				}
+				pthread_detach(helper);
+			}
+			pthread_sigmask(SIG_SETMASK, &old, NULL);
+			b_size = queue_size;
+		}
+	}
 
+	if(usec == 0){
+		preempt();
+	}
+	else{
+		set_timer(TIMER_TYPE, timer_handler, usec);
+	}
+	return ret;
+}
 
+void *st_blocking(void *(*fn)(void *), void *arg){
+	blocking_call_t call = {fn, arg, NULL, current->tid, 0};
 
+	if(b_size == 0 && st_blocking_init(BLOCKING_THREADS, BLOCKING_QUEUE) < 0){
+		return fn(arg);
+	}
 
+	// no preemption while b_mutex is held, another thread locking it would
+	// block the kernel thread
+	while(true){
+		stop_timer(TIMER_TYPE, timer_handler);
+		pthread_mutex_lock(&b_mutex);
+		if(b_count < b_size){
+			break;
+		}
+		pthread_mutex_unlock(&b_mutex);
+		schedule(); // the queue is full, let other threads run
+	}
+	b_queue[(b_head + b_count) % b_size] = &call;
+	b_count++;
+	pthread_cond_signal(&b_cond);
+	pthread_mutex_unlock(&b_mutex);
+	set_timer(TIMER_TYPE, timer_handler, TIMEOUT);
 
+	// the helper unparks the caller exactly once, after done is set. Park at
+	// least once so that this unpark is consumed here and does not make a later
+	// st_park() of the caller return early.
+	do{
+		st_park();
+	} while(!__atomic_load_n(&call.done, __ATOMIC_ACQUIRE));
+	return call.result;
+}
+
+void st_lockstat_enable(int dump_at_exit){
+	if(!STHREADS_INSTRUMENT){
+		return;
+	}
+	if(dump_at_exit && !lockstat_on){
+		atexit(lockstat_exit);
+	}
+	lockstat_on = 1;
+}
+
+void st_lockstat_dump(FILE *out){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+
+	int n = 0;
+	for(lockstat_t *ls = lockstats; ls != NULL; ls = ls->next){
+		n++;
+	}
+	lockstat_t **sorted = (lockstat_t **) malloc(sizeof(lockstat_t *) * (n + 1));
+	if(sorted == NULL){
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	n = 0;
+	for(lockstat_t *ls = lockstats; ls != NULL; ls = ls->next){
+		sorted[n++] = ls;
+	}
+	qsort(sorted, n, sizeof(lockstat_t *), lockstat_cmp);
+
+	fprintf(out, "%-6s %-20s %10s %10s %14s %12s %14s %12s\n", "kind", "label", "acquires",
+		"contended", "total wait us", "max wait us", "total hold us", "max hold us");
+	for(int i=0; i<n; i++){
+		lockstat_t *ls = sorted[i];
+		char label[32];
+		if(ls->label != NULL){
+			snprintf(label, sizeof(label), "%s", ls->label);
+		}
+		else{
+			snprintf(label, sizeof(label), "#%d", ls->id);
+		}
+		fprintf(out, "%-6s %-20s %10ld %10ld %14.1f %12.1f", ls->kind, label, ls->acquires,
+			ls->contended, ls->wait_total / 1000.0, ls->wait_max / 1000.0);
+		if(strcmp(ls->kind, "mutex") == 0){
+			fprintf(out, " %14.1f %12.1f\n", ls->hold_total / 1000.0, ls->hold_max / 1000.0);
+		}
+		else{
+			fprintf(out, " %14s %12s\n", "-", "-");
+		}
+		if(ls->contended > 0){
+			fprintf(out, "       waits by log2(ns):");
+			for(int b=0; b<ST_HIST_BUCKETS; b++){
+				if(ls->hist[b] > 0){
+					fprintf(out, " %d:%ld", b, ls->hist[b]);
+				}
+			}
+			fprintf(out, "\n");
+		}
+	}
+	free(sorted);
+
+	set_timer(TIMER_TYPE, timer_handler, usec == 0 ? TIMEOUT : usec);
+}
+
+int st_prof_start(const char *path, int hz){
+#if !STHREADS_INSTRUMENT
+	return -1;
+#else
+	if(prof_samples != NULL || hz <= 0 || hz > 1000000){
+		return -1;
+	}
+	prof_samples = (prof_sample_t *) calloc(PROF_SAMPLES, sizeof(prof_sample_t));
+	if(prof_samples == NULL){
+		return -1;
+	}
+	prof_path = path;
+	atexit(prof_exit);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = prof_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+#ifndef STHREADS_NO_PREEMPT
+	sigaddset(&sa.sa_mask, timer_signal(TIMER_TYPE));
+#endif
+	sigaction(SIGPROF, &sa, NULL);
+
+	// ITIMER_PROF counts CPU time and is independent of the TIMER_TYPE preemption timer
+	struct itimerval timer;
+	timer.it_value.tv_sec = 0;
+	timer.it_value.tv_usec = 1000000 / hz;
+	timer.it_interval = timer.it_value;
+	if(setitimer(ITIMER_PROF, &timer, NULL) < 0){
+		perror("Setting timer");
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+int st_snapshot(st_thread_info_t *info, int max){
+	int usec = stop_timer(TIMER_TYPE, timer_handler);
+	int n = t_num;
+	for(int i=0; i<n && i<max; i++){
+		thread_info(threads[i], &info[i]);
+	}
+	set_timer(TIMER_TYPE, timer_handler, usec == 0 ? TIMEOUT : usec);
+	return n;
+}
+
+void st_dump(int fd){
+	const char *states[] = {"running", "ready", "waiting", "terminated"};
+	const char *blockers[] = {"-", "mutex", "cond", "sem", "join", "sleep", "park", "waitgroup"};
+	char line[128];
+	int len = 0;
+
+	dump_str(line, &len, "tid", 8);
+	dump_str(line, &len, "state", 12);
+	dump_str(line, &len, "blocked on", 12);
+	dump_str(line, &len, "id", 6);
+	dump_str(line, &len, "run us", 14);
+	dump_str(line, &len, "stack B", 10);
+	line[len++] = '\n';
+	if(write(fd, line, len) < 0){
+		return;
+	}
+
+	for(int i=0; i<t_num; i++){
+		st_thread_info_t info;
+		thread_info(threads[i], &info);
+
+		len = 0;
+		dump_num(line, &len, info.tid, 8);
+		dump_str(line, &len, states[info.state], 12);
+		dump_str(line, &len, blockers[info.blocked_on], 12);
+		if(info.object >= 0){
+			dump_num(line, &len, info.object, 6);
+		}
+		else{
+			dump_str(line, &len, "-", 6);
+		}
+		dump_num(line, &len, info.run_ns / 1000, 14);
+		dump_num(line, &len, info.stack_used, 10);
+		line[len++] = '\n';
+		if(write(fd, line, len) < 0){
+			return;
+		}
+	}
+}
+
+int st_dump_on_signal(int signum){
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+#ifndef STHREADS_NO_PREEMPT
+	sigaddset(&sa.sa_mask, timer_signal(TIMER_TYPE));
+#endif
+	return sigaction(signum, &sa, NULL);
+}
@@ -11,6 +11,16 @@
 */
 
 #include <ucontext.h>
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
+#include "sthreads_config.h"
+
+/* Number of buckets of the lock statistics wait-time histogram. */
+#define ST_HIST_BUCKETS 32
+
+/* Number of thread-local storage keys that can be created. */
+#define ST_KEYS_MAX 16
 
 /* A thread can be in one of the following states. */
 typedef enum {running, ready, waiting, terminated} state_t;
@@ -18,7 +28,11 @@ typedef enum {running, ready, waiting, terminated} state_t;
 /* Thread ID. */
 typedef int tid_t;
 
+/* Thread-local storage key, an index into the tls slots of every thread. */
+typedef int st_key_t;
+
 typedef struct thread thread_t;
+typedef struct waitgroup waitgroup_t;
 
 /* Data to manage a single thread should be kept in this structure. Here are a few
    suggestions of data you may want in this structure but you may change this to
@@ -28,27 +42,119 @@ struct thread {
   tid_t tid;
   state_t state;
   ucontext_t ctx;
+  void (*start)(); // the start function the thread was spawned with (NULL for main)
+  void *arg; // argument for start, used by spawn_future()
   int mid; // the mutex id that the thread is waiting for (-1 if thread is not waiting for any mutex to be freed);
   int cid; // the cond_t id that the thread is waiting for (-1 if thread is not waiting for any cond_t to be signaled);
   int sid; // the semaphore id that the thread is waiting for (-1 if thread is not waiting for any semaphore to be signaled);
+  long wake; // the time in us when a sleeping thread should be woken up (-1 if thread is not sleeping)
+  int parked; // 1 if the thread waits in st_park(), -1 if st_unpark() was called before it parked, 0 otherwise
+  int detached; // 1 if the thread is deleted as soon as it terminates instead of by join()
+  int prio; // scheduling priority or number of tickets, set with st_setprio() (default 1)
+  long pass; // virtual time of the stride policy, advanced by a stride inversely proportional to prio
+  char *arena_base; // the arena carved from the thread's own region (NULL for main)
+  char *arena; // next free byte of the current arena chunk
+  char *arena_end; // end of the current arena chunk
+  waitgroup_t *wg; // the wait group the thread is waiting for (NULL if thread is not waiting for any wait group);
+  void *chunks; // arena chunks allocated with malloc() once the thread's own arena is full
+  void *tls[ST_KEYS_MAX]; // the thread's value for each st_key_t (NULL if not set)
+  long run_ns; // time in ns the thread has been running, not counting the current run
+  long run_start; // the time in ns the thread was last switched to
   thread_t *next; /* can use this to create a linked list of threads */
 };
 
+/* What a waiting thread waits for, see st_snapshot(). */
+typedef enum {st_on_none, st_on_mutex, st_on_cond, st_on_sem, st_on_join,
+              st_on_sleep, st_on_park, st_on_waitgroup} st_blocker_t;
+
+/* A thread as seen by st_snapshot(). */
+typedef struct {
+	tid_t tid;
+	state_t state;
+	st_blocker_t blocked_on; // st_on_none unless state is waiting
+	int object; // the mid, cid or sid blocked on, -1 for the other blockers
+	void (*start)(); // the start function (NULL for main)
+	long run_ns; // time the thread has been running
+	size_t stack_used; // bytes between the base of the stack and the stack pointer (0 if unknown)
+	size_t stack_size; // size of the stack (0 if unknown)
+} st_thread_info_t;
+
+/* Contention statistics of a mutex_t, cond_t or sem_t, times are in ns. For a
+   cond_t an acquire is a cond_wait() and the wait lasts until it is signaled.
+   Hold times are only kept for a mutex_t.
+*/
+typedef struct lockstat {
+	const char *label; // set with lock_init_label(), cond_init_label() or sem_init_label() (may be NULL)
+	const char *kind; // "mutex", "cond" or "sem"
+	int id; // mid, cid or sid of the primitive
+	long acquires; // number of lock(), cond_wait() or sem_wait() calls
+	long contended; // number of those calls that had to wait
+	long wait_total;
+	long wait_max;
+	long hist[ST_HIST_BUCKETS]; // hist[i] counts the waits of [2^i, 2^(i+1)) ns, the last bucket also longer ones
+	long hold_total;
+	long hold_max;
+	long hold_start; // the time the holder acquired the mutex
+	struct lockstat *next;
+} lockstat_t;
+
 typedef struct __lock_t {
 	int mid; // mutex id
 	int flag; // 1: lock is held, 0: lock is not held
+	lockstat_t *stat; // NULL if statistics are disabled
 } mutex_t;
 
 typedef struct __cond_t{
 	int cid;
 	mutex_t * m;
+	lockstat_t *stat; // NULL if statistics are disabled
 } cond_t;
 
 typedef struct __sem_t{
 	int sid;
 	int value;
+	lockstat_t *stat; // NULL if statistics are disabled
 } sem_t;
 
+struct waitgroup {
+	int count; // number of dependencies that are not finished
+	thread_t *waiter; // the thread waiting for count to reach 0 (NULL if none)
+};
+
+typedef struct __future_t{
+	tid_t tid; // the thread computing the result
+	int done; // 1 when result is set
+	void *result;
+	void *(*fn)(void *);
+	void *arg;
+	waitgroup_t *wg; // the wait group of the thread waiting for the future (NULL if none)
+} future_t;
+
+/* A scheduling policy decides which ready thread runs next. The scheduler calls
+   the hooks with the timer signal blocked, the policy keeps its own queue of
+   ready threads (the next field of thread_t can be used to link them).
+*/
+typedef struct sched_policy {
+	const char *name;
+	void      (*enqueue)(thread_t *t);  // t is ready to run
+	thread_t *(*pick_next)();           // removes and returns the thread to run next, NULL if none is ready
+	void      (*on_block)(thread_t *t); // the running thread t stopped to wait or terminated
+	void      (*on_wake)(thread_t *t);  // t was spawned or stopped waiting, called before enqueue()
+	int       (*on_tick)(thread_t *t);  // the running thread t used up its time slice, returns 1 to preempt it
+} sched_policy_t;
+
+/* Policies provided by the library.
+
+   sched_fifo     - threads run until they wait, yield() or done(), never preempted.
+   sched_rr       - round robin, preempted every time slice (the default).
+   sched_stride   - proportional share, a thread with prio n runs n times as often as a thread with prio 1.
+   sched_priority - the ready thread with the highest prio runs, round robin among equals.
+*/
+extern const sched_policy_t sched_fifo;
+extern const sched_policy_t sched_rr;
+extern const sched_policy_t sched_stride;
+extern const sched_policy_t sched_priority;
+
 /*******************************************************************************
                                Simple Threads API
 
@@ -63,9 +169,20 @@ new functions to the API.
    must call this function exactly once before calling any other functions in
    the Simple Threads API.
 
+   init() uses the policy named by the STHREADS_POLICY environment variable
+   (fifo, rr, stride or priority) and sched_rr if it is not set.
+   init_policy() uses the given policy.
+
    Returns 1 on success and a negative value on failure.
 */
 int init();
+int init_policy(const sched_policy_t *policy);
+
+/* Sets the priority of the thread with id tid, used by sched_stride and
+   sched_priority. Returns 0 on success and -1 if prio < 1 or there is no such
+   thread.
+*/
+int st_setprio(tid_t tid, int prio);
 
 /* Creates a new thread executing the start function.
 
@@ -103,17 +220,189 @@ void  done();
 */
 tid_t join();
 
+/* Detached threads
+
+   spawn_detached() creates a new thread like spawn() that is never joined.
+   detach() makes the thread with id tid detached, or deletes it if it has
+   already terminated. When a detached thread calls done() its stack and
+   control block are reclaimed by the next thread to run, and join() does not
+   wait for it. Returns the thread id, or 0 on success and -1 if there is no
+   such thread.
+*/
+tid_t spawn_detached(void (*start)());
+int   detach(tid_t tid);
+
+/* Sleeping and parking
+
+   st_sleep() suspends the calling thread for at least usec microseconds.
+
+   st_park() suspends the calling thread until st_unpark() is called with its
+   thread id. st_unpark() may be called from another thread, a signal handler or
+   another kernel thread. If st_unpark() is called before the thread parks, the
+   next st_park() returns immediately. st_unpark() returns 0 on success and -1 if
+   tid is not a valid thread id (<= 0) or too many requests are pending. Unknown
+   and terminated threads are ignored.
+
+   When no thread is ready, the scheduler sleeps in sigsuspend() until a sleeping
+   thread times out or a thread is unparked. If all threads are waiting for a
+   mutex, cond_t, sem_t or join() none of them can be woken up and the program is
+   terminated.
+*/
+void st_sleep(long usec);
+void st_park();
+int  st_unpark(tid_t tid);
+
+/* Per-thread arena allocation
+
+   st_alloc() returns size bytes of memory owned by the calling thread, or NULL
+   on failure. Memory is taken from an arena carved from the thread's own region
+   next to its stack and can not be freed one allocation at a time.
+   st_arena_reset() releases everything the calling thread has allocated with
+   st_alloc(). All of it is also released when the thread calls done().
+*/
+void *st_alloc(size_t size);
+void  st_arena_reset();
+
+/* Thread-local storage
+
+   st_key_create() creates a new key visible to all threads and stores it in
+   key. Every thread has its own value for the key, initially NULL. If
+   destructor is not NULL it is called with the thread's value when a thread
+   with a non-NULL value calls done(). Returns 0 on success and -1 when
+   ST_KEYS_MAX keys already exist.
+
+   st_getspecific() and st_setspecific() get and set the calling thread's value
+   for key. The key must have been returned by st_key_create().
+*/
+int   st_key_create(st_key_t *key, void (*destructor)(void *));
+void *st_getspecific(st_key_t key);
+void  st_setspecific(st_key_t key, void *value);
+
+/* Futures
+
+   spawn_future() creates a new thread computing fn(arg) and returns a future
+   for the result, or NULL on failure. future_get() suspends the calling thread
+   until the result is available and returns it.
+
+   wait_all() suspends the calling thread until all n futures in fs are done and
+   wait_any() until at least one of them is, returning the index of a finished
+   future, or -1 at once if there are none (n <= 0). A future can only be
+   waited for by one thread at a time.
+
+   future_exit() ends the calling thread as if fn had returned result. Called by
+   a thread not created by spawn_future() it is the same as done().
+
+   future_free() frees a finished future and the resources of its thread.
+*/
+future_t *spawn_future(void *(*fn)(void *), void *arg);
+void     *future_get(future_t *f);
+void      future_exit(void *result);
+void      wait_all(future_t **fs, int n);
+int       wait_any(future_t **fs, int n);
+void      future_free(future_t *f);
+
+/* Wait groups
+
+   A wait group counts unfinished work. wg_init() sets the count and wg_add()
+   adds n to it. wg_done() counts down by one and wakes the thread waiting in
+   wg_wait() when the count reaches 0. wg_wait() suspends the calling thread
+   until the count is 0. Only one thread can wait for a wait group.
+*/
+void wg_init(waitgroup_t * wg, int count);
+void wg_add(waitgroup_t * wg, int n);
+void wg_done(waitgroup_t * wg);
+void wg_wait(waitgroup_t * wg);
+
+/* Offloading blocking calls
+
+   st_blocking() suspends the calling thread and runs fn(arg) on a pool of helper
+   kernel threads, so that a blocking system call such as read(), fsync() or
+   getaddrinfo() does not stop the other threads. The calling thread is resumed
+   with the return value of fn when the call returns. fn must not use the Simple
+   Threads API. While the queue of calls is full the calling thread yields.
+
+   st_blocking_init() starts nthreads helper threads with room for queue_size
+   queued calls and returns 1 on success and -1 on failure. It must be called
+   before the first st_blocking() to change the default of 4 helpers and 64
+   queued calls and has no effect after that.
+*/
+int   st_blocking_init(int nthreads, int queue_size);
+void *st_blocking(void *(*fn)(void *), void *arg);
+
+/* Lock statistics
+
+   st_lockstat_enable() turns on contention accounting for every mutex_t, cond_t
+   and sem_t initialized after it is called, primitives initialized before are
+   not accounted. Setting the STHREADS_LOCKSTAT environment variable enables it
+   from init() with dump_at_exit set. While disabled the cost of each operation
+   is a test of the stat pointer.
+
+   The statistics of a primitive can be read at any time through its stat field.
+   st_lockstat_dump() prints the statistics of all accounted primitives to out,
+   sorted by total wait time. If dump_at_exit is 1 they are printed to stderr
+   when the program exits. The *_init_label() functions set the label shown for
+   the primitive, label must stay valid until the program exits.
+*/
+void st_lockstat_enable(int dump_at_exit);
+void st_lockstat_dump(FILE *out);
+
+/* Sampling profiler
+
+   st_prof_start() samples the running thread hz times per second of CPU time
+   with SIGPROF. Each sample records the thread id, its start function and a
+   frame pointer backtrace (compile with -fno-omit-frame-pointer and link with
+   -rdynamic for function names). When the program exits the samples are written
+   to path in the folded stack format read by flame graph tools, one line per
+   distinct stack: sthread-<tid>;<start function>;<outermost frame>;...;<innermost frame> <count>.
+   Setting the STHREADS_PROF environment variable to a path starts the profiler
+   from init(). Returns 0 on success and -1 on failure or if it is already running.
+*/
+int st_prof_start(const char *path, int hz);
+
+/* Thread introspection
+
+   st_snapshot() copies the state of up to max threads into info and returns the
+   total number of threads. Only the copy runs with the timer stopped. A waiting
+   thread in future_get(), wait_all() or wait_any() is blocked on st_on_waitgroup
+   and one in st_blocking() on st_on_park. run_ns is 0 when sthreads is compiled
+   with STHREADS_INSTRUMENT 0.
+
+   st_dump() writes one line per thread with the same information to fd. It
+   does not allocate and only calls write(), so it can be called from a signal
+   handler. st_dump_on_signal() installs a handler that dumps to stderr when
+   signum is received and returns 0 on success and -1 on failure. Setting the
+   STHREADS_DUMP environment variable installs it for SIGUSR1 from init(). A
+   dump from a signal handler that interrupted the scheduler may show a thread
+   in the middle of a state change.
+*/
+int  st_snapshot(st_thread_info_t *info, int max);
+void st_dump(int fd);
+int  st_dump_on_signal(int signum);
+
+/* Mutexes, condition variables and semaphores
+
+   A mutex_t or cond_t whose memory is all zero, like a global one, is
+   initialized on first use. trylock() takes the mutex if it is free and returns
+   0, or returns -1 without waiting. cond_broadcast() wakes all threads waiting
+   for c. The sem_*() functions always return 0, they have the POSIX signatures
+   so that pthread_shim.c can pass them through.
+*/
 void lock_init(mutex_t * m );
+void lock_init_label(mutex_t * m, const char *label);
 void lock(mutex_t * m);
+int  trylock(mutex_t * m);
 void unlock(mutex_t * m);
 
 void cond_init(cond_t * c);
+void cond_init_label(cond_t * c, const char *label);
 void cond_wait(cond_t * c, mutex_t * m);
 void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
 
-void sem_init(sem_t * s, int pshared, int value);
-void sem_wait(sem_t * s);
-void sem_post(sem_t *s);
+int sem_init(sem_t * s, int pshared, int value);
+int sem_init_label(sem_t * s, int pshared, int value, const char *label);
+int sem_wait(sem_t * s);
+int sem_post(sem_t *s);
 
 #endif
 
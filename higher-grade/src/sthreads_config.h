@@ -0,0 +1,46 @@
+#ifndef STHREADS_CONFIG_H
+#define STHREADS_CONFIG_H
+
+/* Compile-time configuration of sthreads
+
+   Every setting can be overridden with -D when sthreads.c is compiled, the
+   Makefile builds a few combinations for bin/config_bench.
+*/
+
+#include <signal.h> /* SIGSTKSZ */
+
+/* Maximum number of threads, including main. With 0 the thread table grows and
+   shrinks with realloc(), otherwise it is a static table and spawn() fails
+   once it is full.
+*/
+#ifndef STHREADS_MAX_THREADS
+#define STHREADS_MAX_THREADS 0
+#endif
+
+/* Stack size of each spawned thread in bytes. */
+#ifndef STHREADS_STACK_SIZE
+#define STHREADS_STACK_SIZE (SIGSTKSZ*100)
+#endif
+
+/* Define STHREADS_NO_PREEMPT for a cooperative build. Threads only switch when
+   they call the API, there is no preemption timer and no timer signal is
+   blocked and unblocked around the API calls. on_tick() of the policy is never
+   called.
+*/
+/* #define STHREADS_NO_PREEMPT */
+
+/* Policy used by init() when the STHREADS_POLICY environment variable is not
+   set, one of sched_fifo, sched_rr, sched_stride or sched_priority.
+*/
+#ifndef STHREADS_DEFAULT_POLICY
+#define STHREADS_DEFAULT_POLICY sched_rr
+#endif
+
+/* With 0 the lock statistics and the sampling profiler are compiled out,
+   st_lockstat_enable() does nothing and st_prof_start() fails.
+*/
+#ifndef STHREADS_INSTRUMENT
+#define STHREADS_INSTRUMENT 1
+#endif
+
+#endif
@@ -144,6 +144,108 @@ void add_lock(){
 	done();
 }
 
+st_key_t name_key;
+
+void print_name(void *name){
+	printf("%s done\n", (char *) name);
+}
+
+void named(){
+	static int n = 0;
+	char *name = st_alloc(16);
+	snprintf(name, 16, "named %d", n++);
+	st_setspecific(name_key, name);
+	for(int i=0; i<3; i++){
+		printf("%s\n", (char *) st_getspecific(name_key));
+		yield();
+	}
+	done();
+}
+
+void *square(void *arg){
+	long n = (long) arg;
+	return (void *) (n * n);
+}
+
+/* Computes the squares 1, 4, ..., 100 in separate threads and prints their sum.
+ */
+void scatter_gather(){
+	future_t *fs[10];
+	long sum = 0;
+
+	for(long i=0; i<10; i++){
+		fs[i] = spawn_future(square, (void *) (i + 1));
+	}
+	wait_all(fs, 10);
+	for(int i=0; i<10; i++){
+		sum += (long) future_get(fs[i]);
+		future_free(fs[i]);
+	}
+	printf("sum of squares = %ld\n", sum);
+	done();
+}
+
+void *slow_square(void *arg){
+	for(int i=0; i<100; i++){
+		yield();
+	}
+	return square(arg);
+}
+
+waitgroup_t members;
+volatile int arrived = 0;
+
+void member(){
+	arrived++;
+	wg_done(&members);
+	done();
+}
+
+void check(int ok, const char *what){
+	if(!ok){
+		fprintf(stderr, "[ERROR] %s\n", what);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Checks the results of futures, wait_all(), wait_any() and wait groups, exits
+   the program when one is wrong.
+ */
+void check_futures(){
+	future_t *fs[10];
+	long sum = 0;
+
+	for(long i=0; i<10; i++){
+		fs[i] = spawn_future(square, (void *) (i + 1));
+		check(fs[i] != NULL, "spawn_future() failed");
+	}
+	wait_all(fs, 10);
+	for(int i=0; i<10; i++){
+		sum += (long) future_get(fs[i]);
+		future_free(fs[i]);
+	}
+	check(sum == 385, "sum of squares 1..10 is not 385");
+
+	fs[0] = spawn_future(slow_square, (void *) 3);
+	fs[1] = spawn_future(square, (void *) 4);
+	int first = wait_any(fs, 2);
+	check(first == 0 || first == 1, "wait_any() returned no index of a future");
+	check((long) future_get(fs[first]) == (first == 0 ? 9 : 16), "wrong result of the future wait_any() returned");
+	check((long) future_get(fs[0]) == 9 && (long) future_get(fs[1]) == 16, "wrong future results");
+	future_free(fs[0]);
+	future_free(fs[1]);
+	check(wait_any(NULL, 0) == -1, "wait_any() without futures did not return -1");
+
+	wg_init(&members, 3);
+	for(int i=0; i<3; i++){
+		spawn(member);
+	}
+	wg_wait(&members);
+	check(arrived == 3, "wg_wait() returned before all wg_done() calls");
+
+	printf("futures and wait groups ok\n");
+}
+
 #define MAX_c 100
 int buffer_c[MAX_c];
 int fill_ptr = 0;
@@ -263,6 +365,8 @@ int main(){
 	sem_init(&full_s, 0, 0);
 	sem_init(&mutex_s, 0, 1);
 
+	st_key_create(&name_key, print_name);
+
 	//spawn(numbers);
 	//spawn(letters);
 	//spawn(magic_numbers);
@@ -285,6 +389,14 @@ int main(){
 	// spawn(consumer_c);
 	// spawn(producer_c);
 
+	// thread-local storage test
+	// spawn(named);
+	// spawn(named);
+
+	// futures test
+	// spawn(scatter_gather);
+	check_futures();
+
 	// semaphore test
 	// spawn(producer_s);
 	// spawn(consumer_s);
@@ -2,6 +2,8 @@
 #include <string.h> // strcpy()
 #include <stdio.h>	// perror()
 #include <stdlib.h>	// malloc()
+#include <errno.h>	// EAGAIN, EINTR
+#include <time.h>	// clock_gettime(), nanosleep()
 
 
 
@@ -54,12 +56,65 @@ void s_wait(semaphore_t *sem) {
   }
 }
 
+int s_trywait(semaphore_t *sem) {
+  if (sem_trywait(sem->sem) == -1) {
+    if (errno == EAGAIN) {
+      return -1;
+    }
+    perror_and_abort(sem, "sem_trywait()");
+  }
+  return 0;
+}
+
+/*
+  macOS has no sem_timedwait(). Poll with sem_trywait() and sleep a little
+  longer after each failed poll, at most POLL_MAX ns.
+*/
+#define POLL_MIN 1000L
+#define POLL_MAX 1000000L
+
+int s_timedwait(semaphore_t *sem, const struct timespec *deadline) {
+  long pause = POLL_MIN;
+
+  while (s_trywait(sem) == -1) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long left_sec = deadline->tv_sec - now.tv_sec;
+    long left_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left_sec < 0 || (left_sec == 0 && left_nsec <= 0)) {
+      return -1;
+    }
+    if (left_sec == 0 && left_nsec < pause) {
+      pause = left_nsec;
+    }
+
+    struct timespec ts = {0, pause};
+    nanosleep(&ts, NULL);
+    pause = pause * 2 > POLL_MAX ? POLL_MAX : pause * 2;
+  }
+  return 0;
+}
+
 void s_signal(semaphore_t *sem) {
   if (sem_post(sem->sem) == -1) {
     perror_and_abort(sem, "sem_post()");
   }
 }
 
+// named semaphores have no batched sem_post()
+void s_signal_n(semaphore_t *sem, unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    s_signal(sem);
+  }
+}
+
+// sem_getvalue() is not implemented on macOS
+int s_getvalue(semaphore_t *sem) {
+  (void) sem;
+  return -1;
+}
+
 void s_destroy(semaphore_t *sem) {
   cleanup(sem);
 }
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE // syscall()
+
+#include <stdio.h>          // perror()
+#include <stdlib.h>         // malloc()
+#include <errno.h>          // EAGAIN, EINTR, ETIMEDOUT
+#include <limits.h>         // INT_MAX
+#include <unistd.h>         // syscall(), sysconf()
+#include <sys/syscall.h>    // SYS_futex
+#include <linux/futex.h>    // FUTEX_WAIT_BITSET_PRIVATE, FUTEX_WAKE_PRIVATE
+
+#include "semaphores.h"
+
+/*
+  Semaphores on Linux futexes, selected with SEMAPHORES=futex.
+
+  The counter is changed with atomic instructions. A thread only enters the
+  kernel when the counter is still 0 after spinning, and s_signal() only
+  enters it when a thread sleeps or is about to. A waiter counts itself in
+  waiters before it checks the counter a last time, and s_signal() increments
+  the counter before it reads waiters, so a wake-up is never lost.
+*/
+
+#define SPIN 100 // polls of the counter before sleeping
+
+// SPIN, or 0 on a single CPU where the signaling thread can not run while
+// the waiter spins
+static int spin = -1;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline, NULL to wait
+// without one
+static long futex(int *addr, int op, int val, const struct timespec *deadline) {
+  return syscall(SYS_futex, addr, op, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+// decrements the counter if it is positive, returns 1 on success
+static int try_decrement(semaphore_t *sem) {
+  int count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+  while (count > 0) {
+    if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 1,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+semaphore_t *s_init(unsigned int value) {
+  semaphore_t *sem = malloc(sizeof(semaphore_t));
+
+  if (sem == NULL) {
+    perror("Initializing new semaphore");
+    abort();
+  }
+  sem->count = value;
+  sem->waiters = 0;
+  if (spin < 0) {
+    spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN : 0;
+  }
+  return sem;
+}
+
+// returns 0 once the counter is decremented, -1 if deadline passed first
+static int wait_until(semaphore_t *sem, const struct timespec *deadline) {
+  for (int i = 0; i < spin; i++) {
+    if (try_decrement(sem)) {
+      return 0;
+    }
+    cpu_relax();
+  }
+
+  int ok;
+  __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+  while (!(ok = try_decrement(sem))) {
+    // sleeps only if the counter is still 0
+    if (futex(&sem->count, FUTEX_WAIT_BITSET_PRIVATE, 0, deadline) == -1) {
+      if (errno == ETIMEDOUT) {
+        ok = try_decrement(sem);
+        break;
+      }
+      if (errno != EAGAIN && errno != EINTR) {
+        perror("Wating on sempahore failed");
+        abort();
+      }
+    }
+  }
+  __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_RELAXED);
+  return ok ? 0 : -1;
+}
+
+void s_wait(semaphore_t *sem) {
+  wait_until(sem, NULL);
+}
+
+int s_trywait(semaphore_t *sem) {
+  return try_decrement(sem) ? 0 : -1;
+}
+
+int s_timedwait(semaphore_t *sem, const struct timespec *deadline) {
+  return wait_until(sem, deadline);
+}
+
+void s_signal(semaphore_t *sem) {
+  __atomic_fetch_add(&sem->count, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0 &&
+      futex(&sem->count, FUTEX_WAKE_PRIVATE, 1, NULL) == -1) {
+    perror("Signaling on semaphore failed");
+    abort();
+  }
+}
+
+// one FUTEX_WAKE for all n instead of one per s_signal()
+void s_signal_n(semaphore_t *sem, unsigned int n) {
+  if (n == 0) {
+    return;
+  }
+  __atomic_fetch_add(&sem->count, n, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0 &&
+      futex(&sem->count, FUTEX_WAKE_PRIVATE, n > INT_MAX ? INT_MAX : (int) n, NULL) == -1) {
+    perror("Signaling on semaphore failed");
+    abort();
+  }
+}
+
+int s_getvalue(semaphore_t *sem) {
+  return __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+}
+
+void s_destroy(semaphore_t *sem) {
+  free(sem);
+}
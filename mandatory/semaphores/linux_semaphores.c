@@ -1,5 +1,8 @@
+#define _GNU_SOURCE // sem_clockwait()
+
 #include <stdio.h> // perror()
 #include <stdlib.h> // malloc()
+#include <errno.h> // EAGAIN, EINTR, ETIMEDOUT
 
 #include "semaphores.h"
 
@@ -20,6 +23,59 @@ void s_wait(semaphore_t *sem) {
   }
 }
 
+int s_trywait(semaphore_t *sem) {
+  if (sem_trywait(sem) == -1) {
+    if (errno == EAGAIN) {
+      return -1;
+    }
+    perror("Wating on sempahore failed");
+    abort();
+  }
+  return 0;
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 30)
+
+static int clockwait(semaphore_t *sem, const struct timespec *deadline) {
+  return sem_clockwait(sem, CLOCK_MONOTONIC, deadline);
+}
+
+#else
+
+// sem_timedwait() only takes a CLOCK_REALTIME deadline, a jump of the
+// wall clock moves the monotonic deadline with it
+static int clockwait(semaphore_t *sem, const struct timespec *deadline) {
+  struct timespec now, real;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  clock_gettime(CLOCK_REALTIME, &real);
+  real.tv_sec += deadline->tv_sec - now.tv_sec;
+  real.tv_nsec += deadline->tv_nsec - now.tv_nsec;
+  if (real.tv_nsec < 0) {
+    real.tv_sec--;
+    real.tv_nsec += 1000000000L;
+  } else if (real.tv_nsec >= 1000000000L) {
+    real.tv_sec++;
+    real.tv_nsec -= 1000000000L;
+  }
+  return sem_timedwait(sem, &real);
+}
+
+#endif
+
+int s_timedwait(semaphore_t *sem, const struct timespec *deadline) {
+  while (clockwait(sem, deadline) == -1) {
+    if (errno == ETIMEDOUT) {
+      return -1;
+    }
+    if (errno != EINTR) {
+      perror("Wating on sempahore failed");
+      abort();
+    }
+  }
+  return 0;
+}
+
 void s_signal(semaphore_t *sem) {
   if (sem_post(sem) == -1) {
     perror("Signaling on semaphore failed");
@@ -27,6 +83,23 @@ void s_signal(semaphore_t *sem) {
   }
 }
 
+// glibc has no batched sem_post(), each post wakes at most one waiter
+void s_signal_n(semaphore_t *sem, unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    s_signal(sem);
+  }
+}
+
+int s_getvalue(semaphore_t *sem) {
+  int value;
+
+  if (sem_getvalue(sem, &value) == -1) {
+    perror("Reading semaphore failed");
+    abort();
+  }
+  return value;
+}
+
 void s_destroy(semaphore_t *sem) {
   if (sem_destroy(sem) == -1) {
     perror("Destroying semaphore failed");
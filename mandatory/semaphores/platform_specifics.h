@@ -1,6 +1,13 @@
 #include <semaphore.h>	// sem_open(), sem_close(), sem_unlink(), sem_wait(), sem_post()
 
-#ifdef __linux__
+#if defined(__linux__) && defined(SEMAPHORES_FUTEX)
+
+typedef struct {
+  int count;   // value of the semaphore
+  int waiters; // threads sleeping in s_wait() or about to
+} semaphore_t;
+
+#elif defined(__linux__)
 typedef sem_t semaphore_t;
 #endif
 
@@ -6,7 +6,8 @@
   semaphore implementation.
 
   On error all functions in the API prints an error message an terminates the
-  program.
+  program. A semaphore that can not be decremented before the deadline is not
+  an error, s_trywait() and s_timedwait() report it with their return value.
 
   History
 
@@ -15,6 +16,8 @@
   First version by Karl Marklund <karl.marklund@it.uu.se>.
 */
 
+#include <time.h> // struct timespec
+
 /* Platform dependent definition of the semaphore_t data type. */
 #include "platform_specifics.h"
 
@@ -43,6 +46,28 @@ semaphore_t *s_init(unsigned int value);
 */
 void s_wait(semaphore_t *sem);
 
+/* s_trywait(sem)
+
+   Like s_wait(), but never blocks.
+
+   Return value
+
+   0 if the counter was decremented, -1 if the counter was zero.
+*/
+int s_trywait(semaphore_t *sem);
+
+/* s_timedwait(sem, deadline)
+
+   Like s_wait(), but blocks at most until deadline, an absolute time on the
+   CLOCK_MONOTONIC clock (see clock_gettime()). A deadline in the past makes
+   it behave like s_trywait().
+
+   Return value
+
+   0 if the counter was decremented, -1 if the deadline passed first.
+*/
+int s_timedwait(semaphore_t *sem, const struct timespec *deadline);
+
 /* s_signal(sem)
 
    Atomically increments the counter of the semaphore pointed to by sem.  If
@@ -52,6 +77,26 @@ void s_wait(semaphore_t *sem);
 */
 void s_signal(semaphore_t *sem);
 
+/* s_signal_n(sem, n)
+
+   Increments the counter of the semaphore pointed to by sem by n and wakes up
+   to n processes or threads blocked in s_wait(), like n calls of s_signal().
+   Where the platform allows it the waiters are woken with a single call into
+   the kernel.
+*/
+void s_signal_n(semaphore_t *sem, unsigned int n);
+
+/* s_getvalue(sem)
+
+   Return value
+
+   The current counter of the semaphore pointed to by sem, which may already
+   have changed when the caller looks at it. Meant for statistics and
+   debugging, not for deciding whether s_wait() would block. On platforms that
+   can not read the counter -1 is returned.
+*/
+int s_getvalue(semaphore_t *sem);
+
 /* s_destroy(sem)
 
    Destroys the semaphore pointed to by sem. Only a semaphore that has been
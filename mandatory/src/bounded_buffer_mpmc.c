@@ -0,0 +1,404 @@
+/**
+ * Multi-producer/multi-consumer bounded buffer
+ *
+ * Several producer threads hand items to several consumer threads. Compares
+ * two bounded buffers:
+ *
+ *   sem    the locking bounded buffer of bounded_buffer.c, with an empty and a
+ *          full semaphore and one mutex that serializes every insert and
+ *          remove
+ *   queue  a queue with a sequence number per slot (after Dmitry Vyukov's
+ *          bounded MPMC queue)
+ *
+ * In the queue a producer claims the next slot with one fetch-and-add of
+ * enqueue_pos and a consumer with one of dequeue_pos. Ticket t uses slot
+ * t % capacity in lap t / capacity. The sequence number of a slot says whose
+ * turn it is: t when the producer of ticket t may write the slot, t + 1 when
+ * the consumer of ticket t may read it. The consumer hands the slot on to the
+ * producer of the next lap by setting it to t + capacity, which differs from
+ * t + 1 only with at least two slots. Producers and
+ * consumers of different slots never touch the same cache line.
+ *
+ * A thread whose slot is not ready yet, because the queue is full or empty,
+ * polls the sequence number for a while on a multi-core machine and then
+ * sleeps on it with FUTEX_WAIT. The thread that changes the sequence number
+ * only calls FUTEX_WAKE when someone sleeps on the slot.
+ *
+ * Both buffers stamp every item with timing_ticks() when it is inserted. Each
+ * consumer records the hand-off latency from insertion to removal in its own
+ * histogram, and the histograms are merged after the run.
+ *
+ * Usage: bin/bounded_buffer_mpmc [-n items] [-c capacity] [-t PxC,...]
+ */
+
+/* syscall() is not declared with only _XOPEN_SOURCE */
+#define _GNU_SOURCE
+
+#include <stdio.h>     /* printf(), fprintf() */
+#include <stdlib.h>    /* abort(), malloc(), atol() */
+#include <stdint.h>    /* uint32_t, uint64_t */
+#include <stdbool.h>   /* true, false */
+#include <limits.h>    /* INT_MAX */
+#include <string.h>    /* strtok(), strdup() */
+#include <pthread.h>   /* pthread_... */
+#include <unistd.h>    /* getopt(), syscall(), sysconf() */
+#include <sys/syscall.h>    /* SYS_futex */
+#include <linux/futex.h>    /* FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE */
+
+#include "semaphores.h" /* s_init(), s_wait(), s_signal(), s_destroy() */
+#include "timing.h"     /* timing_start(), timing_ticks(), timing_hist_... */
+
+#define ITEMS 4000000
+#define CAPACITY 1024
+#define CONFIGS "1x1,2x4,4x2,4x4"
+#define MAX_THREADS 64
+#define CACHE_LINE 64
+#define SPIN_LIMIT 100
+
+long items = ITEMS;
+unsigned long capacity = CAPACITY;
+
+/* Producers and consumers of the current run */
+int producers, consumers;
+
+/* An item and the timing_ticks() when it was inserted */
+typedef struct {
+    long value;
+    uint64_t inserted;
+} item_t;
+
+/* Hand-off latency of the items each consumer removed in the current run */
+struct timing_hist handoff[MAX_THREADS];
+
+/* SPIN_LIMIT, or 0 on a single CPU where the thread that would make the slot
+ * ready can not run while we poll */
+int spin;
+
+static inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static long
+futex(uint32_t *addr, int op, int val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+typedef struct {
+    uint32_t seq;       /* turn, the low 32 bits of a ticket */
+    uint32_t sleepers;  /* threads in FUTEX_WAIT on seq or about to */
+    item_t item;
+} __attribute__((aligned(CACHE_LINE))) cell_t;
+
+typedef struct {
+    uint64_t enqueue_pos __attribute__((aligned(CACHE_LINE)));
+    uint64_t dequeue_pos __attribute__((aligned(CACHE_LINE)));
+    unsigned long mask __attribute__((aligned(CACHE_LINE)));
+    cell_t *cells;
+} queue_t;
+
+queue_t queue;
+
+/* Number of FUTEX_WAIT calls in the current run */
+long sleeps;
+
+void
+queue_init(queue_t *q, unsigned long capacity)
+{
+    q->enqueue_pos = q->dequeue_pos = 0;
+    q->mask = capacity - 1;
+    if (posix_memalign((void **)&q->cells, CACHE_LINE, capacity * sizeof(cell_t)) != 0) {
+        perror("posix_memalign");
+        abort();
+    }
+    for (unsigned long i = 0; i < capacity; i++) {
+        q->cells[i].seq = i;
+        q->cells[i].sleepers = 0;
+    }
+}
+
+/* Waits until the sequence number of c is turn. A sleeper counts itself
+ * before it checks seq a last time in FUTEX_WAIT, and set_turn() changes seq
+ * before it reads sleepers, so a wake-up is never lost. */
+static void
+wait_turn(cell_t *c, uint32_t turn)
+{
+    for (int i = 0; i < spin; i++) {
+        if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) == turn)
+            return;
+        cpu_relax();
+    }
+
+    __atomic_fetch_add(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST);
+        if (seq == turn)
+            break;
+        /* slots are shared by all laps, sleep until seq changes */
+        futex(&c->seq, FUTEX_WAIT_PRIVATE, seq);
+        __atomic_fetch_add(&sleeps, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&c->sleepers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+/* Hands c on to the thread whose turn is turn */
+static void
+set_turn(cell_t *c, uint32_t turn)
+{
+    __atomic_store_n(&c->seq, turn, __ATOMIC_SEQ_CST);
+    /* threads of several laps may sleep on c, wake all of them */
+    if (__atomic_load_n(&c->sleepers, __ATOMIC_SEQ_CST) > 0)
+        futex(&c->seq, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+void
+queue_push(queue_t *q, long item)
+{
+    uint64_t ticket = __atomic_fetch_add(&q->enqueue_pos, 1, __ATOMIC_RELAXED);
+    cell_t *c = &q->cells[ticket & q->mask];
+
+    wait_turn(c, ticket);
+    c->item = (item_t){ item, timing_ticks() };
+    set_turn(c, ticket + 1);
+}
+
+item_t
+queue_pop(queue_t *q)
+{
+    uint64_t ticket = __atomic_fetch_add(&q->dequeue_pos, 1, __ATOMIC_RELAXED);
+    cell_t *c = &q->cells[ticket & q->mask];
+
+    wait_turn(c, ticket + 1);
+    item_t item = c->item;
+    set_turn(c, ticket + q->mask + 1);
+    return item;
+}
+
+/* Bounded buffer with semaphores and a mutex */
+typedef struct {
+    item_t *value;
+    unsigned long next_in, next_out;
+    semaphore_t *empty, *full;
+    pthread_mutex_t mutex;
+} buffer_t;
+
+buffer_t buffer;
+
+void
+buffer_push(long item)
+{
+    s_wait(buffer.empty);
+    pthread_mutex_lock(&buffer.mutex);
+    buffer.value[buffer.next_in] = (item_t){ item, timing_ticks() };
+    buffer.next_in = (buffer.next_in + 1) % capacity;
+    pthread_mutex_unlock(&buffer.mutex);
+    s_signal(buffer.full);
+}
+
+item_t
+buffer_pop()
+{
+    s_wait(buffer.full);
+    pthread_mutex_lock(&buffer.mutex);
+    item_t item = buffer.value[buffer.next_out];
+    buffer.next_out = (buffer.next_out + 1) % capacity;
+    pthread_mutex_unlock(&buffer.mutex);
+    s_signal(buffer.empty);
+    return item;
+}
+
+struct impl_t {
+    void (*push)(long item);
+    item_t (*pop)();
+    char *name;
+};
+
+void queue_push_item(long item) { queue_push(&queue, item); }
+item_t queue_pop_item() { return queue_pop(&queue); }
+
+struct impl_t impls[] = {
+    { .push = buffer_push,     .pop = buffer_pop,     .name = "sem" },
+    { .push = queue_push_item, .pop = queue_pop_item, .name = "queue" },
+};
+
+struct thread_conf_t {
+    pthread_t tid;
+    int id;
+    struct impl_t *impl;
+    long sum;   /* of the items a consumer removed */
+};
+
+/* Items handled by thread id of n threads */
+static long
+share(int id, int n)
+{
+    return items / n + (id < items % n);
+}
+
+/* Producer id inserts the items id, id + producers, ... below items */
+void *
+producer(void *arg)
+{
+    struct thread_conf_t *conf = arg;
+
+    for (long i = conf->id; i < items; i += producers)
+        conf->impl->push(i);
+
+    return NULL;
+}
+
+void *
+consumer(void *arg)
+{
+    struct thread_conf_t *conf = arg;
+
+    conf->sum = 0;
+    for (long i = share(conf->id, consumers); i > 0; i--) {
+        item_t item = conf->impl->pop();
+        timing_hist_record(&handoff[conf->id], timing_ticks() - item.inserted);
+        conf->sum += item.value;
+    }
+
+    return NULL;
+}
+
+/* Runs one implementation with the current producers and consumers, returns false if
+ * the consumers did not get every item exactly once */
+bool
+run(struct impl_t *impl)
+{
+    struct thread_conf_t prod[MAX_THREADS], cons[MAX_THREADS];
+    struct timespec ts;
+    long sum = 0;
+
+    sleeps = 0;
+    for (int i = 0; i < consumers; i++)
+        timing_hist_init(&handoff[i]);
+    timing_start(&ts);
+    for (int i = 0; i < consumers; i++) {
+        cons[i] = (struct thread_conf_t){ .id = i, .impl = impl };
+        if (pthread_create(&cons[i].tid, NULL, consumer, &cons[i]) != 0) {
+            perror("pthread_create");
+            abort();
+        }
+    }
+    for (int i = 0; i < producers; i++) {
+        prod[i] = (struct thread_conf_t){ .id = i, .impl = impl };
+        if (pthread_create(&prod[i].tid, NULL, producer, &prod[i]) != 0) {
+            perror("pthread_create");
+            abort();
+        }
+    }
+    for (int i = 0; i < producers; i++)
+        pthread_join(prod[i].tid, NULL);
+    for (int i = 0; i < consumers; i++) {
+        pthread_join(cons[i].tid, NULL);
+        sum += cons[i].sum;
+    }
+    double secs = timing_stop(&ts);
+
+    bool ok = sum == items * (items - 1) / 2;
+    char threads[16];
+    snprintf(threads, sizeof(threads), "%dx%d", producers, consumers);
+    printf("%-6s %6s %14.0f items/s %10.1f ns/item", impl->name, threads,
+           items / secs, secs * 1E9 / items);
+    if (impl->push == queue_push_item)
+        printf(" %10ld sleeps", sleeps);
+    else
+        printf(" %17s", "");
+    printf("  %s\n", ok ? "ok" : "FAIL: items lost or duplicated");
+
+    for (int i = 1; i < consumers; i++)
+        timing_hist_merge(&handoff[0], &handoff[i]);
+    printf("              hand-off p50 %8.0f ns   p99 %8.0f ns   p99.9 %8.0f ns\n",
+           timing_ticks_to_ns(timing_hist_percentile(&handoff[0], 0.5)),
+           timing_ticks_to_ns(timing_hist_percentile(&handoff[0], 0.99)),
+           timing_ticks_to_ns(timing_hist_percentile(&handoff[0], 0.999)));
+    fflush(stdout);
+    return ok;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n items] [-c capacity] [-t PxC,...]\n"
+            "  -n  items to hand over (default %d)\n"
+            "  -c  capacity, a power of two of at least 2 (default %d)\n"
+            "  -t  producers x consumers to sweep (default %s, at most %d each)\n",
+            prog, ITEMS, CAPACITY, CONFIGS, MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *configs = CONFIGS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:t:")) != -1) {
+        switch (opt) {
+        case 'n': items = atol(optarg); break;
+        case 'c': capacity = atol(optarg); break;
+        case 't': configs = optarg; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    /* with a single slot, the hand-off to the next lap (t + capacity) would
+     * equal the ready turn of consumer t (t + 1) */
+    if (optind < argc || items < 1 || capacity < 2 || capacity > (1UL << 30) ||
+        (capacity & (capacity - 1)) != 0)
+        usage(argv[0]);
+
+    spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    printf("%ld items, capacity %lu\n", items, capacity);
+
+    buffer.value = malloc(capacity * sizeof(item_t));
+    if (buffer.value == NULL) {
+        perror("malloc");
+        abort();
+    }
+    pthread_mutex_init(&buffer.mutex, NULL);
+
+    bool ok = true;
+    char *list = strdup(configs);
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        if (sscanf(tok, "%dx%d", &producers, &consumers) != 2 ||
+            producers < 1 || producers > MAX_THREADS ||
+            consumers < 1 || consumers > MAX_THREADS)
+            usage(argv[0]);
+
+        buffer.next_in = buffer.next_out = 0;
+        buffer.empty = s_init(capacity);
+        buffer.full = s_init(0);
+        ok &= run(&impls[0]);
+        s_destroy(buffer.empty);
+        s_destroy(buffer.full);
+
+        queue_init(&queue, capacity);
+        ok &= run(&impls[1]);
+        free(queue.cells);
+    }
+    free(list);
+    free(buffer.value);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "stroustrup"
+ * End:
+ */
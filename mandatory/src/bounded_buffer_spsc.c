@@ -0,0 +1,294 @@
+/**
+ * Single-producer/single-consumer bounded buffer
+ *
+ * One producer thread hands items to one consumer thread. Compares two
+ * bounded buffers:
+ *
+ *   sem   the locking bounded buffer of bounded_buffer.c, with an empty and a
+ *         full semaphore and a mutex around every insert and remove
+ *   ring  a lock-free ring buffer that only works with one producer and one
+ *         consumer
+ *
+ * The ring has a power-of-two capacity, so a slot is the index masked with
+ * capacity - 1. head and tail count all items ever inserted and removed, each
+ * is only written by one side and lives on its own cache line. The producer
+ * publishes an item with a release store of head, the consumer frees its slot
+ * with a release store of tail, and each side reads the other's index with an
+ * acquire load. Each side also keeps a private copy of the other's index and
+ * only reloads it when the copy says the ring is full or empty, so the cache
+ * line of the other index only moves when needed. The fast path takes no lock
+ * and makes no system call, a side that finds the ring full or empty spins
+ * and then yields the CPU.
+ *
+ * Both buffers stamp every item with timing_ticks() when it is inserted, and
+ * the consumer records the hand-off latency from insertion to removal.
+ *
+ * Usage: bin/bounded_buffer_spsc [-n items] [-c capacity]
+ */
+
+#include <stdio.h>     /* printf(), fprintf() */
+#include <stdlib.h>    /* abort(), malloc(), atol() */
+#include <stdint.h>    /* uint64_t */
+#include <stdbool.h>   /* true, false */
+#include <pthread.h>   /* pthread_... */
+#include <sched.h>     /* sched_yield() */
+#include <unistd.h>    /* getopt() */
+
+#include "semaphores.h" /* s_init(), s_wait(), s_signal(), s_destroy() */
+#include "timing.h"     /* timing_start(), timing_ticks(), timing_hist_... */
+
+#define ITEMS 10000000
+#define CAPACITY 1024
+#define CACHE_LINE 64
+#define SPIN_LIMIT 64
+
+long items = ITEMS;
+unsigned long capacity = CAPACITY;
+
+/* An item and the timing_ticks() when it was inserted */
+typedef struct {
+    long value;
+    uint64_t inserted;
+} item_t;
+
+/* Hand-off latency of the items the consumer removed in the current run */
+struct timing_hist handoff;
+
+static inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Polls SPIN_LIMIT times, then gives the CPU to the other side, which may
+ * share it */
+static inline void
+spin_wait(int *spins)
+{
+    if (++*spins < SPIN_LIMIT) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+/* Lock-free SPSC ring */
+typedef struct {
+    /* written by the producer */
+    unsigned long head __attribute__((aligned(CACHE_LINE)));
+    unsigned long tail_cache;   /* producer's copy of tail */
+
+    /* written by the consumer */
+    unsigned long tail __attribute__((aligned(CACHE_LINE)));
+    unsigned long head_cache;   /* consumer's copy of head */
+
+    /* read-only after ring_init() */
+    unsigned long mask __attribute__((aligned(CACHE_LINE)));
+    item_t *slots;
+} ring_t;
+
+void
+ring_init(ring_t *r, unsigned long capacity)
+{
+    r->head = r->tail_cache = r->tail = r->head_cache = 0;
+    r->mask = capacity - 1;
+    r->slots = malloc(capacity * sizeof(item_t));
+    if (r->slots == NULL) {
+        perror("malloc");
+        abort();
+    }
+}
+
+/* Returns false if the ring is full, only called by the producer */
+static inline bool
+ring_push(ring_t *r, long item)
+{
+    unsigned long head = r->head;
+
+    if (head - r->tail_cache > r->mask) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - r->tail_cache > r->mask)
+            return false;
+    }
+    r->slots[head & r->mask] = (item_t){ item, timing_ticks() };
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Returns false if the ring is empty, only called by the consumer */
+static inline bool
+ring_pop(ring_t *r, item_t *item)
+{
+    unsigned long tail = r->tail;
+
+    if (tail == r->head_cache) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (tail == r->head_cache)
+            return false;
+    }
+    *item = r->slots[tail & r->mask];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+ring_t ring;
+
+void *
+ring_producer(void *arg __attribute__((unused)))
+{
+    for (long i = 0; i < items; i++) {
+        int spins = 0;
+        while (!ring_push(&ring, i))
+            spin_wait(&spins);
+    }
+
+    return NULL;
+}
+
+void *
+ring_consumer(void *arg)
+{
+    item_t item;
+
+    for (long i = 0; i < items; i++) {
+        int spins = 0;
+        while (!ring_pop(&ring, &item))
+            spin_wait(&spins);
+        timing_hist_record(&handoff, timing_ticks() - item.inserted);
+        if (item.value != i)
+            *(bool *)arg = false;
+    }
+
+    return NULL;
+}
+
+/* Bounded buffer with semaphores and a mutex */
+typedef struct {
+    item_t *value;
+    unsigned long next_in, next_out;
+    semaphore_t *empty, *full;
+    pthread_mutex_t mutex;
+} buffer_t;
+
+buffer_t buffer;
+
+void *
+sem_producer(void *arg __attribute__((unused)))
+{
+    for (long i = 0; i < items; i++) {
+        s_wait(buffer.empty);
+        pthread_mutex_lock(&buffer.mutex);
+        buffer.value[buffer.next_in] = (item_t){ i, timing_ticks() };
+        buffer.next_in = (buffer.next_in + 1) % capacity;
+        pthread_mutex_unlock(&buffer.mutex);
+        s_signal(buffer.full);
+    }
+
+    return NULL;
+}
+
+void *
+sem_consumer(void *arg)
+{
+    item_t item;
+
+    for (long i = 0; i < items; i++) {
+        s_wait(buffer.full);
+        pthread_mutex_lock(&buffer.mutex);
+        item = buffer.value[buffer.next_out];
+        buffer.next_out = (buffer.next_out + 1) % capacity;
+        pthread_mutex_unlock(&buffer.mutex);
+        s_signal(buffer.empty);
+        timing_hist_record(&handoff, timing_ticks() - item.inserted);
+        if (item.value != i)
+            *(bool *)arg = false;
+    }
+
+    return NULL;
+}
+
+/* Runs one producer and one consumer, returns false if the consumer saw the
+ * items out of order */
+bool
+run(const char *name, void *(*producer)(void *), void *(*consumer)(void *))
+{
+    pthread_t producer_tid, consumer_tid;
+    struct timespec ts;
+    bool in_order = true;
+
+    timing_hist_init(&handoff);
+    timing_start(&ts);
+    if (pthread_create(&consumer_tid, NULL, consumer, &in_order) != 0 ||
+        pthread_create(&producer_tid, NULL, producer, NULL) != 0) {
+        perror("pthread_create");
+        abort();
+    }
+    pthread_join(producer_tid, NULL);
+    pthread_join(consumer_tid, NULL);
+    double secs = timing_stop(&ts);
+
+    printf("%-6s %14.0f items/s %10.1f ns/item  %s\n", name, items / secs,
+           secs * 1E9 / items, in_order ? "ok" : "FAIL: out of order");
+    printf("       hand-off p50 %8.0f ns   p99 %8.0f ns   p99.9 %8.0f ns\n",
+           timing_ticks_to_ns(timing_hist_percentile(&handoff, 0.5)),
+           timing_ticks_to_ns(timing_hist_percentile(&handoff, 0.99)),
+           timing_ticks_to_ns(timing_hist_percentile(&handoff, 0.999)));
+    return in_order;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+        case 'n': items = atol(optarg); break;
+        case 'c': capacity = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n items] [-c capacity]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (capacity < 1 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "capacity must be a power of two\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%ld items, capacity %lu\n", items, capacity);
+
+    buffer.value = malloc(capacity * sizeof(item_t));
+    if (buffer.value == NULL) {
+        perror("malloc");
+        abort();
+    }
+    buffer.next_in = buffer.next_out = 0;
+    buffer.empty = s_init(capacity);
+    buffer.full = s_init(0);
+    pthread_mutex_init(&buffer.mutex, NULL);
+    bool ok = run("sem", sem_producer, sem_consumer);
+    s_destroy(buffer.empty);
+    s_destroy(buffer.full);
+    free(buffer.value);
+
+    ring_init(&ring, capacity);
+    ok &= run("ring", ring_producer, ring_consumer);
+    free(ring.slots);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "stroustrup"
+ * End:
+ */
@@ -7,27 +7,71 @@
  *
  */
 
+/* syscall() is not declared with only _XOPEN_SOURCE */
+#define _GNU_SOURCE
+
 #include <stdio.h>     /* printf(), fprintf() */
-#include <stdlib.h>    /* abort() */
+#include <stdlib.h>    /* abort(), malloc(), free() */
 #include <pthread.h>   /* pthread_... */
 #include <stdbool.h>   /* true, false */
+#include <sched.h>     /* sched_yield(), cpu_set_t */
+#include <string.h>    /* strcmp(), strtok(), strdup() */
+#include <unistd.h>    /* getopt(), sysconf() */
+
+#ifdef __linux__
+#include <sys/syscall.h>    /* SYS_futex */
+#include <linux/futex.h>    /* FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE */
+#endif
 
 #include "timing.h"
 
 
-/* Number of threads that will increment the shared variable */
+/* Number of threads that will increment the shared variable (default, see -t) */
 #define INC_THREADS 5
 /* Value by which the threads increment the shared variable */
 #define INCREMENT 2
-/* Iterations performed incrementing the shared variable */
-#define INC_ITERATIONS 2000000
+/* Iterations performed incrementing the shared variable (see -i) */
+#define INC_ITERATIONS inc_iterations
 
-/* Number of threads that will try to decrement the shared variable */
+/* Number of threads that will try to decrement the shared variable (default, see -t) */
 #define DEC_THREADS 4
 /* Value by which the threads increment the shared variable */
 #define DECREMENT 2
-/* Iterations performed decrementing the shared variable.*/
-#define DEC_ITERATIONS (INC_ITERATIONS * INC_THREADS * INCREMENT / DEC_THREADS / DECREMENT)
+/* Iterations performed decrementing the shared variable, set by main() so
+ * that the decrements cancel the increments */
+#define DEC_ITERATIONS dec_iterations
+
+int inc_iterations = 2000000;
+int dec_iterations;
+
+/* Work inside the critical section and between two critical sections, in
+ * loop iterations (see -c and -w) */
+int cs_work = 0;
+int noncs_work = 0;
+
+/* Histogram of the calling thread's lock acquisition times in ticks, NULL
+ * unless -L was given */
+__thread struct timing_hist *acquire_hist = NULL;
+
+/* Runs the acquire statement and records how long it took */
+#define TIMED_ACQUIRE(acquire)                                          \
+    do {                                                                \
+        if (acquire_hist) {                                             \
+            uint64_t _start = timing_ticks();                           \
+            acquire;                                                    \
+            timing_hist_record(acquire_hist, timing_ticks() - _start);  \
+        } else {                                                        \
+            acquire;                                                    \
+        }                                                               \
+    } while (0)
+
+/* Runs n iterations of an empty loop the compiler can not remove */
+static inline void
+delay(int n)
+{
+    for (int i = 0; i < n; i++)
+        __asm__ __volatile__("" ::: "memory");
+}
 
 /* Shared variable */
 volatile int counter;
@@ -46,7 +90,9 @@ inc_mutex(void *arg __attribute__((unused)))
     /* TODO 1: Protect access to the shared variable with a mutex lock */
 
     for (i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter += INCREMENT;
+        delay(cs_work);
     }
 
     return NULL;
@@ -60,7 +106,9 @@ dec_mutex(void *arg __attribute__((unused)))
     /* TODO 1: Protect access to the shared variable with a mutex lock */
 
     for (i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter -= DECREMENT;
+        delay(cs_work);
     }
 
     return NULL;
@@ -83,7 +131,9 @@ inc_tas_spinlock(void *arg __attribute__((unused)))
     /* TODO 2: Add the spin_lock() and spin_unlock() operations */
 
     for (i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter += INCREMENT; 
+        delay(cs_work);
     }
 
     return NULL;
@@ -97,7 +147,9 @@ dec_tas_spinlock(void *arg __attribute__((unused)))
     /* TODO 2: Add the spin_lock() and spin_unlock() operations */
 
     for (i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter -= DECREMENT; 
+        delay(cs_work);
     }
 
     return NULL;
@@ -114,7 +166,9 @@ inc_atomic(void *arg __attribute__((unused)))
     /* TODO 3: Use atomic primitives to manipulate the shared variable */
 
     for (i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter += DECREMENT; // You need to replace this
+        delay(cs_work);
     }
 
     return NULL;
@@ -128,12 +182,604 @@ dec_atomic(void *arg __attribute__((unused)))
     /* TODO 3: Use atomic primitives to manipulate the shared variable */
 
     for (i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
         counter += DECREMENT; // You need to replace this
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+
+
+/* The locks below spin on their own state. The waiters of a fair lock must
+ * run in order, so after SPIN_LIMIT failed polls a waiter yields the CPU in
+ * case the thread it waits for is preempted. */
+#define SPIN_LIMIT 64
+/* Upper bound of the TTAS backoff, in polls */
+#define BACKOFF_MAX 1024
+#define CACHE_LINE 64
+
+static inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void
+spin_wait(int *spins)
+{
+    if (++*spins < SPIN_LIMIT) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+/* Ticket lock: a thread takes the next ticket and waits until it is served */
+struct {
+    volatile unsigned next __attribute__((aligned(CACHE_LINE)));
+    volatile unsigned serving __attribute__((aligned(CACHE_LINE)));
+} ticket;
+
+void ticket_lock() {
+    unsigned me = __atomic_fetch_add(&ticket.next, 1, __ATOMIC_RELAXED);
+    int spins = 0;
+    while (__atomic_load_n(&ticket.serving, __ATOMIC_ACQUIRE) != me)
+        spin_wait(&spins);
+}
+
+void ticket_unlock() {
+    __atomic_store_n(&ticket.serving, ticket.serving + 1, __ATOMIC_RELEASE);
+}
+
+/* Test-and-test-and-set lock, a thread that loses the race for the lock
+ * backs off for an exponentially growing number of polls */
+volatile int ttas __attribute__((aligned(CACHE_LINE))) = false;
+
+void ttas_lock() {
+    int delay = 1, spins = 0;
+    while (true) {
+        while (__atomic_load_n(&ttas, __ATOMIC_RELAXED))
+            spin_wait(&spins);
+        if (!__atomic_exchange_n(&ttas, true, __ATOMIC_ACQUIRE))
+            return;
+        for (int i = 0; i < delay; i++)
+            cpu_relax();
+        if (delay < BACKOFF_MAX)
+            delay *= 2;
+    }
+}
+
+void ttas_unlock() {
+    __atomic_store_n(&ttas, false, __ATOMIC_RELEASE);
+}
+
+/* MCS queue lock: every waiter spins on the locked flag of its own node,
+ * which its predecessor clears on unlock */
+typedef struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile int locked;
+} __attribute__((aligned(CACHE_LINE))) mcs_node_t;
+
+mcs_node_t *volatile mcs_tail = NULL;
+
+void mcs_lock(mcs_node_t *me) {
+    me->next = NULL;
+    me->locked = true;
+    mcs_node_t *pred = __atomic_exchange_n(&mcs_tail, me, __ATOMIC_ACQ_REL);
+    if (pred != NULL) {
+        int spins = 0;
+        __atomic_store_n(&pred->next, me, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE))
+            spin_wait(&spins);
+    }
+}
+
+void mcs_unlock(mcs_node_t *me) {
+    mcs_node_t *succ = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if (succ == NULL) {
+        mcs_node_t *expected = me;
+        if (__atomic_compare_exchange_n(&mcs_tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+        /* a successor swapped the tail but has not linked itself yet */
+        int spins = 0;
+        while ((succ = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL)
+            spin_wait(&spins);
+    }
+    __atomic_store_n(&succ->locked, false, __ATOMIC_RELEASE);
+}
+
+/* CLH queue lock: every waiter spins on the node of its predecessor and
+ * takes that node over for its next acquisition. The node left in the tail
+ * after a run is unlocked and serves as the dummy of the next run. */
+typedef struct clh_node {
+    volatile int locked;
+} __attribute__((aligned(CACHE_LINE))) clh_node_t;
+
+clh_node_t clh_dummy = { .locked = false };
+clh_node_t *volatile clh_tail = &clh_dummy;
+
+clh_node_t *clh_lock(clh_node_t *me) {
+    int spins = 0;
+    me->locked = true;
+    clh_node_t *pred = __atomic_exchange_n(&clh_tail, me, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&pred->locked, __ATOMIC_ACQUIRE))
+        spin_wait(&spins);
+    return pred;
+}
+
+/* Returns the node to use for the next clh_lock() */
+clh_node_t *clh_unlock(clh_node_t *me, clh_node_t *pred) {
+    __atomic_store_n(&me->locked, false, __ATOMIC_RELEASE);
+    return pred;
+}
+
+clh_node_t *
+clh_node_new()
+{
+    clh_node_t *node;
+    if (posix_memalign((void **)&node, CACHE_LINE, sizeof(clh_node_t)) != 0) {
+        perror("posix_memalign");
+        abort();
+    }
+    return node;
+}
+
+void
+clh_node_free(clh_node_t *node)
+{
+    if (node != &clh_dummy)
+        free(node);
+}
+
+#ifdef __linux__
+pthread_spinlock_t spinlock;
+
+__attribute__((constructor)) static void
+spinlock_init()
+{
+    pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE);
+}
+
+/* Futex mutex (Drepper, "Futexes Are Tricky"): 0 unlocked, 1 locked,
+ * 2 locked with waiters that sleep in the kernel */
+volatile int futex_word __attribute__((aligned(CACHE_LINE))) = 0;
+
+static long
+futex(volatile int *addr, int op, int val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+void futex_lock() {
+    int c = 0;
+    if (__atomic_compare_exchange_n(&futex_word, &c, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    if (c != 2)
+        c = __atomic_exchange_n(&futex_word, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex(&futex_word, FUTEX_WAIT_PRIVATE, 2);
+        c = __atomic_exchange_n(&futex_word, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void futex_unlock() {
+    if (__atomic_fetch_sub(&futex_word, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&futex_word, 0, __ATOMIC_RELEASE);
+        futex(&futex_word, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+/* Adaptive mutex: the futex mutex above, but a waiter first spins for as long
+ * as the owner is likely to need. The owner keeps a moving average of how long
+ * it holds the lock and a waiter spins for twice that. When the average is
+ * above ADAPTIVE_SPIN_NS, about the cost of sleeping in the kernel and being
+ * woken up, waiters sleep right away. A preempted owner holds the lock for
+ * the rest of a time slice, which pushes the average up, so on an
+ * oversubscribed machine the waiters stop spinning until short holds bring it
+ * down again. Reading the clock costs about as much as an uncontended
+ * futex_lock(), so only one hold in ADAPTIVE_SAMPLE is timed. */
+#define ADAPTIVE_SPIN_NS 4000
+#define ADAPTIVE_SAMPLE 16
+
+struct {
+    volatile int word;      /* as futex_word */
+    unsigned holds;         /* number of acquisitions, counted by the owner */
+    uint64_t acquired;      /* timing_ticks() when the owner took the lock, 0
+                               if this hold is not timed */
+    uint64_t hold_avg;      /* moving average of the hold time in ticks */
+} __attribute__((aligned(CACHE_LINE))) adaptive;
+
+/* ADAPTIVE_SPIN_NS in ticks */
+uint64_t adaptive_spin_max;
+
+__attribute__((constructor)) static void
+adaptive_init()
+{
+    adaptive_spin_max = ADAPTIVE_SPIN_NS / timing_ticks_to_ns(1);
+}
+
+void adaptive_lock() {
+    int c = 0;
+    if (__atomic_compare_exchange_n(&adaptive.word, &c, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        goto acquired;
+
+    uint64_t avg = __atomic_load_n(&adaptive.hold_avg, __ATOMIC_RELAXED);
+    if (avg <= adaptive_spin_max) {
+        uint64_t budget = 2 * avg;
+        uint64_t start = timing_ticks();
+        while (timing_ticks() - start < budget) {
+            c = 0;
+            if (adaptive.word == 0 &&
+                __atomic_compare_exchange_n(&adaptive.word, &c, 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                goto acquired;
+            cpu_relax();
+        }
+    }
+
+    c = __atomic_exchange_n(&adaptive.word, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex(&adaptive.word, FUTEX_WAIT_PRIVATE, 2);
+        c = __atomic_exchange_n(&adaptive.word, 2, __ATOMIC_ACQUIRE);
+    }
+
+acquired:
+    adaptive.acquired = ++adaptive.holds % ADAPTIVE_SAMPLE == 0 ? timing_ticks() : 0;
+}
+
+void adaptive_unlock() {
+    if (adaptive.acquired != 0) {
+        int64_t hold = timing_ticks() - adaptive.acquired;
+        int64_t avg = adaptive.hold_avg;
+        __atomic_store_n(&adaptive.hold_avg, avg + (hold - avg) / 8, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_fetch_sub(&adaptive.word, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&adaptive.word, 0, __ATOMIC_RELEASE);
+        futex(&adaptive.word, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+#endif
+
+void *
+inc_ticket(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(ticket_lock());
+        counter += INCREMENT;
+        delay(cs_work);
+        ticket_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+dec_ticket(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(ticket_lock());
+        counter -= DECREMENT;
+        delay(cs_work);
+        ticket_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+inc_ttas(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(ttas_lock());
+        counter += INCREMENT;
+        delay(cs_work);
+        ttas_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+dec_ttas(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(ttas_lock());
+        counter -= DECREMENT;
+        delay(cs_work);
+        ttas_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+inc_mcs(void *arg __attribute__((unused)))
+{
+    mcs_node_t node;
+
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(mcs_lock(&node));
+        counter += INCREMENT;
+        delay(cs_work);
+        mcs_unlock(&node);
+    }
+
+    return NULL;
+}
+
+void *
+dec_mcs(void *arg __attribute__((unused)))
+{
+    mcs_node_t node;
+
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(mcs_lock(&node));
+        counter -= DECREMENT;
+        delay(cs_work);
+        mcs_unlock(&node);
+    }
+
+    return NULL;
+}
+
+void *
+inc_clh(void *arg __attribute__((unused)))
+{
+    clh_node_t *node = clh_node_new();
+
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        clh_node_t *pred;
+        TIMED_ACQUIRE(pred = clh_lock(node));
+        counter += INCREMENT;
+        delay(cs_work);
+        node = clh_unlock(node, pred);
+    }
+
+    clh_node_free(node);
+    return NULL;
+}
+
+void *
+dec_clh(void *arg __attribute__((unused)))
+{
+    clh_node_t *node = clh_node_new();
+
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        clh_node_t *pred;
+        TIMED_ACQUIRE(pred = clh_lock(node));
+        counter -= DECREMENT;
+        delay(cs_work);
+        node = clh_unlock(node, pred);
+    }
+
+    clh_node_free(node);
+    return NULL;
+}
+
+#ifdef __linux__
+void *
+inc_pthread_spin(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(pthread_spin_lock(&spinlock));
+        counter += INCREMENT;
+        delay(cs_work);
+        pthread_spin_unlock(&spinlock);
+    }
+
+    return NULL;
+}
+
+void *
+dec_pthread_spin(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(pthread_spin_lock(&spinlock));
+        counter -= DECREMENT;
+        delay(cs_work);
+        pthread_spin_unlock(&spinlock);
+    }
+
+    return NULL;
+}
+
+void *
+inc_futex(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(futex_lock());
+        counter += INCREMENT;
+        delay(cs_work);
+        futex_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+dec_futex(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(futex_lock());
+        counter -= DECREMENT;
+        delay(cs_work);
+        futex_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+inc_adaptive(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(adaptive_lock());
+        counter += INCREMENT;
+        delay(cs_work);
+        adaptive_unlock();
+    }
+
+    return NULL;
+}
+
+void *
+dec_adaptive(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        TIMED_ACQUIRE(adaptive_lock());
+        counter -= DECREMENT;
+        delay(cs_work);
+        adaptive_unlock();
+    }
+
+    return NULL;
+}
+#endif
+
+/* Counting without a shared counter. Every thread adds to its own stripe and
+ * a reader sums the stripes. The threads must have distinct ids below
+ * STRIPES. The padded stripes each fill a cache line, the packed ones share
+ * cache lines and show the cost of false sharing. */
+#define STRIPES 256
+
+struct {
+    volatile long value;
+} __attribute__((aligned(CACHE_LINE))) stripes[STRIPES];
+
+volatile long packed_stripes[STRIPES];
+
+/* The shared counter updated with one atomic instruction, the baseline of the
+ * striped counters */
+void *
+inc_fetch_add(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        __atomic_fetch_add(&counter, INCREMENT, __ATOMIC_RELAXED);
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+void *
+dec_fetch_add(void *arg __attribute__((unused)))
+{
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        __atomic_fetch_sub(&counter, DECREMENT, __ATOMIC_RELAXED);
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+/* Only the owner writes a stripe, so a plain store suffices and readers see
+ * whole values */
+void *
+inc_striped(void *arg)
+{
+    volatile long *stripe = &stripes[*(int *)arg].value;
+
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        *stripe += INCREMENT;
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+void *
+dec_striped(void *arg)
+{
+    volatile long *stripe = &stripes[*(int *)arg].value;
+
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        *stripe -= DECREMENT;
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+/* Sums and clears the stripes once the threads have finished */
+int
+read_striped()
+{
+    long sum = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        sum += stripes[i].value;
+        stripes[i].value = 0;
+    }
+    return sum;
+}
+
+void *
+inc_packed(void *arg)
+{
+    volatile long *stripe = &packed_stripes[*(int *)arg];
+
+    for (int i = 0; i < INC_ITERATIONS; i++) {
+        delay(noncs_work);
+        *stripe += INCREMENT;
+        delay(cs_work);
     }
 
     return NULL;
 }
 
+void *
+dec_packed(void *arg)
+{
+    volatile long *stripe = &packed_stripes[*(int *)arg];
+
+    for (int i = 0; i < DEC_ITERATIONS; i++) {
+        delay(noncs_work);
+        *stripe -= DECREMENT;
+        delay(cs_work);
+    }
+
+    return NULL;
+}
+
+int
+read_packed()
+{
+    long sum = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        sum += packed_stripes[i];
+        packed_stripes[i] = 0;
+    }
+    return sum;
+}
+
 
 /***********************************************************/
 /* NOTE: You don't need to modify anything below this line */
@@ -143,13 +789,29 @@ struct func_test_t {
     void * (*inc)(void *);
     void * (*dec)(void *);
     char *name;
+    char *id;   /* selects the test with -l and names it in CSV and JSON */
+    int (*read)();  /* returns the final count if it is not kept in counter */
 };
 
 struct func_test_t func_test[] = {
-    { .inc = inc_mutex,        .dec = dec_mutex,        .name = "Test mutex" },
-    { .inc = inc_tas_spinlock, .dec = dec_tas_spinlock, .name = "Test tas spinlock" },
-    { .inc = inc_atomic,       .dec = dec_atomic,       .name = "Test atomic" },
-    { .inc = NULL,             .dec = NULL,             .name = "stop" }
+    { .inc = inc_mutex,        .dec = dec_mutex,        .name = "Test mutex",                  .id = "mutex" },
+    { .inc = inc_tas_spinlock, .dec = dec_tas_spinlock, .name = "Test tas spinlock",           .id = "tas" },
+    { .inc = inc_atomic,       .dec = dec_atomic,       .name = "Test atomic",                 .id = "atomic" },
+    { .inc = inc_ticket,       .dec = dec_ticket,       .name = "Test ticket lock",            .id = "ticket" },
+    { .inc = inc_ttas,         .dec = dec_ttas,         .name = "Test ttas lock with backoff", .id = "ttas" },
+    { .inc = inc_mcs,          .dec = dec_mcs,          .name = "Test mcs lock",               .id = "mcs" },
+    { .inc = inc_clh,          .dec = dec_clh,          .name = "Test clh lock",               .id = "clh" },
+#ifdef __linux__
+    { .inc = inc_pthread_spin, .dec = dec_pthread_spin, .name = "Test pthread spinlock",       .id = "pthread_spin" },
+    { .inc = inc_futex,        .dec = dec_futex,        .name = "Test futex mutex",            .id = "futex" },
+    { .inc = inc_adaptive,     .dec = dec_adaptive,     .name = "Test adaptive mutex",         .id = "adaptive" },
+#endif
+    { .inc = inc_fetch_add,    .dec = dec_fetch_add,    .name = "Test fetch_add counter",      .id = "fetch_add" },
+    { .inc = inc_striped,      .dec = dec_striped,      .name = "Test striped counter",        .id = "striped",
+      .read = read_striped },
+    { .inc = inc_packed,       .dec = dec_packed,       .name = "Test striped counter without padding",
+      .id = "striped_packed", .read = read_packed },
+    { .inc = NULL,             .dec = NULL,             .name = "stop",                        .id = NULL }
 };
 
 
@@ -158,7 +820,10 @@ typedef struct {
     int id;
     void *(*func)(void *);
     void *arg;
+    int cpu;            /* CPU the thread is pinned to, -1 if not pinned */
     double run_time;
+    struct timing_counters counters;
+    struct timing_hist *acquire;    /* acquisition times, NULL without -L */
 } thread_conf_t;
 
 
@@ -168,11 +833,24 @@ thread_func(void *_conf)
     struct timespec ts;
     thread_conf_t *conf = (thread_conf_t *)_conf;
 
+#ifdef __linux__
+    if (conf->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(conf->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            fprintf(stderr, "Failed to pin thread %d to CPU %d\n", conf->id, conf->cpu);
+    }
+#endif
+
+    acquire_hist = conf->acquire;
+    timing_counters_start(&conf->counters);
     timing_start(&ts);
 
     conf->func(conf->arg);
 
     conf->run_time = timing_stop(&ts);
+    timing_counters_stop(&conf->counters);
 
     pthread_exit(0);
 }
@@ -190,69 +868,319 @@ print_stats(thread_conf_t *threads, int nthreads, int niterations)
 	       i, t->run_time,
 	       niterations / nthreads / t->run_time);
 	run_time_sum += t->run_time;
+
+	/* counters that perf could not measure are left out */
+	bool any = false;
+	for (int c = 0; c < TIMING_NCOUNTERS; c++) {
+	    if (t->counters.value[c] < 0)
+		continue;
+	    printf("%s%lld %s", any ? ", " : "\t\t", t->counters.value[c],
+		   timing_counter_names[c]);
+	    any = true;
+	}
+	if (any)
+	    printf("\n");
     }
 
     printf("\tAverage execution time: %.4f s\n"
 	   "\tAvergage iterations/second: %.4e\n",
 	   run_time_sum / nthreads,
 	   niterations / nthreads / run_time_sum);
+
+    if (threads[0].acquire == NULL)
+        return;
+    struct timing_hist *all = malloc(sizeof(struct timing_hist));
+    timing_hist_init(all);
+    for (int i = 0; i < nthreads; i++)
+        timing_hist_merge(all, threads[i].acquire);
+    if (all->total > 0)
+        printf("\tAcquire latency: p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns\n",
+               timing_ticks_to_ns(timing_hist_percentile(all, 0.5)),
+               timing_ticks_to_ns(timing_hist_percentile(all, 0.99)),
+               timing_ticks_to_ns(timing_hist_percentile(all, 0.999)));
+    free(all);
 }
 
-int
-main()
+
+/* Output formats selected with -f */
+enum format { TEXT, CSV, JSON };
+
+#define MAX_SWEEP 64
+
+static void
+usage(const char *prog)
 {
-    struct func_test_t *_func_test = func_test;
+    fprintf(stderr,
+            "Usage: %s [-t threads,...] [-i iterations] [-c cs work] [-w work]\n"
+            "          [-p] [-r repetitions] [-f text|csv|json] [-l lock,...] [-L]\n"
+            "\n"
+            "  -t  thread counts to sweep, half of them (rounded up) increment\n"
+            "      (default %d, at most %d)\n"
+            "  -i  iterations of each incrementing thread (default %d)\n"
+            "  -c  loop iterations of work inside the critical section (default 0)\n"
+            "  -w  loop iterations of work between critical sections (default 0)\n"
+            "  -p  pin thread n to CPU n modulo the number of CPUs\n"
+            "  -r  repetitions of each configuration (default 1)\n"
+            "  -f  output format, csv and json print one record per configuration\n"
+            "      with the mean, median and p99 time per operation of the threads\n"
+            "  -L  record the latency of every lock acquisition (the locks\n"
+            "      from ticket on) and report p50, p99 and p99.9\n"
+            "  -l  locks to run, by id:",
+            prog, INC_THREADS + DEC_THREADS, STRIPES, inc_iterations);
+    for (struct func_test_t *t = func_test; t->inc; t++)
+        fprintf(stderr, " %s", t->id);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
 
-    while (_func_test->inc && _func_test->dec) {
-        int n, nthreads = 0;
-        thread_conf_t thread_conf[INC_THREADS + DEC_THREADS];
+/* Parses a comma separated list of positive integers into values, returns
+ * their number */
+static int
+parse_list(char *list, int *values, int max)
+{
+    int n = 0;
+    for (char *tok = strtok(list, ","); tok && n < max; tok = strtok(NULL, ",")) {
+        values[n] = atoi(tok);
+        if (values[n] <= 0)
+            return -1;
+        n++;
+    }
+    return n;
+}
 
-        pthread_setconcurrency(INC_THREADS + DEC_THREADS);
+static bool
+selected(const char *locks, const char *id)
+{
+    if (locks == NULL)
+        return true;
+    char *copy = strdup(locks);
+    bool found = false;
+    for (char *tok = strtok(copy, ","); tok && !found; tok = strtok(NULL, ","))
+        found = strcmp(tok, id) == 0;
+    free(copy);
+    return found;
+}
 
-        counter = 0;
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
 
-        pthread_setconcurrency(INC_THREADS + DEC_THREADS + 1);
-        /* Create the threads */
-        for (n = 0; n < INC_THREADS; n++) {
-            thread_conf_t *conf = &thread_conf[nthreads];
-            conf->id = nthreads;
-            conf->func = _func_test->inc;
-            if (pthread_create(&conf->thread, NULL, thread_func, conf) != 0) {
-                perror("pthread_create");
-                abort();
-            }
-            nthreads++;
+/* Nearest-rank percentile of the n sorted values */
+static double
+percentile(const double *sorted, int n, double p)
+{
+    int rank = (int)(p * n + 0.999999);
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+int
+main(int argc, char *argv[])
+{
+    int sweep[MAX_SWEEP] = { INC_THREADS + DEC_THREADS };
+    int nsweep = 1, repetitions = 1, opt;
+    bool pin = false, swept = false, latency = false;
+    enum format format = TEXT;
+    const char *locks = NULL;
+
+    while ((opt = getopt(argc, argv, "t:i:c:w:pr:f:l:L")) != -1) {
+        switch (opt) {
+        case 't':
+            nsweep = parse_list(optarg, sweep, MAX_SWEEP);
+            if (nsweep <= 0)
+                usage(argv[0]);
+            for (int s = 0; s < nsweep; s++)
+                if (sweep[s] > STRIPES)
+                    usage(argv[0]);
+            swept = true;
+            break;
+        case 'i': inc_iterations = atoi(optarg); break;
+        case 'c': cs_work = atoi(optarg); break;
+        case 'w': noncs_work = atoi(optarg); break;
+        case 'p': pin = true; break;
+        case 'r': repetitions = atoi(optarg); break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0)
+                format = TEXT;
+            else if (strcmp(optarg, "csv") == 0)
+                format = CSV;
+            else if (strcmp(optarg, "json") == 0)
+                format = JSON;
+            else
+                usage(argv[0]);
+            break;
+        case 'l': locks = optarg; break;
+        case 'L': latency = true; break;
+        default:
+            usage(argv[0]);
         }
-        for (n = 0; n < DEC_THREADS; n++) {
-            thread_conf_t *conf = &thread_conf[nthreads];
-            conf->id = nthreads;
-            conf->func = _func_test->dec;
-            if (pthread_create(&conf->thread, NULL, thread_func, conf) != 0) {
-                perror("pthread_create");
-                abort();
+    }
+    if (inc_iterations <= 0 || repetitions <= 0 || cs_work < 0 || noncs_work < 0)
+        usage(argv[0]);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    bool first = true;
+
+    if (format == CSV)
+        printf("lock,threads,inc_threads,dec_threads,iterations,cs_work,work,pinned,"
+               "repetitions,status,ops_per_sec,mean_ns,median_ns,p99_ns,"
+               "acquire_p50_ns,acquire_p99_ns,acquire_p999_ns\n");
+    else if (format == JSON)
+        printf("[");
+
+    for (struct func_test_t *_func_test = func_test; _func_test->inc && _func_test->dec; _func_test++) {
+        if (!selected(locks, _func_test->id))
+            continue;
+
+        for (int s = 0; s < nsweep; s++) {
+            int nthreads = sweep[s];
+            int inc_threads = (nthreads + 1) / 2;
+            int dec_threads = nthreads / 2;
+            thread_conf_t thread_conf[nthreads];
+
+            /* the decrements cancel the increments up to the rounding */
+            dec_iterations = dec_threads == 0 ? 0 :
+                (long)inc_iterations * inc_threads * INCREMENT / dec_threads / DECREMENT;
+            long expected = (long)inc_iterations * inc_threads * INCREMENT
+                - (long)dec_iterations * dec_threads * DECREMENT;
+            long ops = (long)inc_iterations * inc_threads + (long)dec_iterations * dec_threads;
+
+            /* time per operation of every thread in every repetition */
+            double samples[nthreads * repetitions];
+            double wall_sum = 0;
+            bool failed = false;
+
+            /* acquisition times of all threads and repetitions */
+            struct timing_hist *acquire = NULL;
+            if (latency) {
+                acquire = malloc((nthreads + 1) * sizeof(struct timing_hist));
+                if (acquire == NULL) {
+                    perror("malloc");
+                    abort();
+                }
+                timing_hist_init(&acquire[nthreads]);
             }
-            nthreads++;
-        }
 
-        /* Wait for them to complete */
-        for (n = 0; n < nthreads; n++)
-            if (pthread_join(thread_conf[n].thread, NULL) != 0) {
-                perror("pthread_join");
-                abort();
+            for (int r = 0; r < repetitions; r++) {
+                struct timespec ts;
+                int n;
+
+                pthread_setconcurrency(nthreads);
+
+                counter = 0;
+
+                pthread_setconcurrency(nthreads + 1);
+                timing_start(&ts);
+                /* Create the threads */
+                for (n = 0; n < nthreads; n++) {
+                    thread_conf_t *conf = &thread_conf[n];
+                    conf->id = n;
+                    conf->func = n < inc_threads ? _func_test->inc : _func_test->dec;
+                    conf->arg = &conf->id;
+                    conf->cpu = pin ? n % ncpus : -1;
+                    conf->acquire = latency ? &acquire[n] : NULL;
+                    if (latency)
+                        timing_hist_init(conf->acquire);
+                    if (pthread_create(&conf->thread, NULL, thread_func, conf) != 0) {
+                        perror("pthread_create");
+                        abort();
+                    }
+                }
+
+                /* Wait for them to complete */
+                for (n = 0; n < nthreads; n++)
+                    if (pthread_join(thread_conf[n].thread, NULL) != 0) {
+                        perror("pthread_join");
+                        abort();
+                    }
+                wall_sum += timing_stop(&ts);
+                if (_func_test->read)
+                    counter = _func_test->read();
+                for (n = 0; latency && n < nthreads; n++)
+                    timing_hist_merge(&acquire[nthreads], &acquire[n]);
+
+                for (n = 0; n < nthreads; n++)
+                    samples[r * nthreads + n] = thread_conf[n].run_time * 1E9 /
+                        (n < inc_threads ? inc_iterations : dec_iterations);
+
+                if (counter != expected)
+                    failed = true;
+
+                if (format != TEXT)
+                    continue;
+                printf("===> %s", _func_test->name);
+                if (swept)
+                    printf(" (%d threads)", nthreads);
+                printf("\n");
+                if (counter != expected) {
+                    printf("     counter expected value:%10ld\n", expected);
+                    printf("     counter actual value:  %10d\n", counter);
+
+                    printf("     Failure\n");
+                } else {
+                    printf("     Success\n");
+                    print_stats(thread_conf, nthreads, ops);
+                }
             }
 
-        printf("===> %s\n", _func_test->name);
-        if (counter != 0) {
-            printf("     counter expected value:%10d\n", 0);
-            printf("     counter actual value:  %10d\n", counter);
+            /* acquisition percentiles in ns, -1 if none were recorded */
+            double acq[3] = { -1, -1, -1 };
+            const double ps[3] = { 0.5, 0.99, 0.999 };
+            for (int i = 0; i < 3 && latency && acquire[nthreads].total > 0; i++)
+                acq[i] = timing_ticks_to_ns(timing_hist_percentile(&acquire[nthreads], ps[i]));
+            free(acquire);
 
-            printf("     Failure\n");
-        } else {
-            printf("     Success\n");
-            print_stats(thread_conf, nthreads, INC_ITERATIONS + DEC_ITERATIONS);
+            if (format == TEXT)
+                continue;
+
+            int nsamples = nthreads * repetitions;
+            double mean = 0;
+            for (int i = 0; i < nsamples; i++)
+                mean += samples[i] / nsamples;
+            qsort(samples, nsamples, sizeof(double), cmp_double);
+
+            if (format == CSV) {
+                printf("%s,%d,%d,%d,%d,%d,%d,%d,%d,%s,%.0f,%.2f,%.2f,%.2f",
+                       _func_test->id, nthreads, inc_threads, dec_threads,
+                       inc_iterations, cs_work, noncs_work, pin, repetitions,
+                       failed ? "fail" : "ok", ops / (wall_sum / repetitions),
+                       mean, percentile(samples, nsamples, 0.5),
+                       percentile(samples, nsamples, 0.99));
+                for (int i = 0; i < 3; i++)
+                    if (acq[i] < 0)
+                        printf(",");
+                    else
+                        printf(",%.0f", acq[i]);
+                printf("\n");
+            } else {
+                printf("%s\n  {\"lock\": \"%s\", \"threads\": %d, \"inc_threads\": %d, "
+                       "\"dec_threads\": %d, \"iterations\": %d, \"cs_work\": %d, "
+                       "\"work\": %d, \"pinned\": %s, \"repetitions\": %d, "
+                       "\"status\": \"%s\", \"ops_per_sec\": %.0f, \"mean_ns\": %.2f, "
+                       "\"median_ns\": %.2f, \"p99_ns\": %.2f",
+                       first ? "" : ",", _func_test->id, nthreads, inc_threads,
+                       dec_threads, inc_iterations, cs_work, noncs_work,
+                       pin ? "true" : "false", repetitions, failed ? "fail" : "ok",
+                       ops / (wall_sum / repetitions), mean,
+                       percentile(samples, nsamples, 0.5),
+                       percentile(samples, nsamples, 0.99));
+                const char *keys[3] = { "acquire_p50_ns", "acquire_p99_ns", "acquire_p999_ns" };
+                for (int i = 0; i < 3; i++)
+                    if (acq[i] < 0)
+                        printf(", \"%s\": null", keys[i]);
+                    else
+                        printf(", \"%s\": %.0f", keys[i], acq[i]);
+                printf("}");
+            }
+            fflush(stdout);
+            first = false;
         }
-        _func_test++;
     }
+
+    if (format == JSON)
+        printf("\n]\n");
     return 0;
 }
 
@@ -0,0 +1,439 @@
+/**
+ * Read-mostly synchronization
+ *
+ * Threads read a shared record far more often than they update it. Every
+ * operation is a read or, with the probability given by the read/write ratio,
+ * a write that stores a new version number in all fields of the record. A
+ * reader checks that all fields it saw hold the same version, a torn read
+ * fails the test.
+ *
+ * Compares a plain mutex, pthread_rwlock_t, a seqlock and an RCU-style
+ * pointer swap with epoch based reclamation, for read/write ratios from
+ * 50/50 to 99.9/0.1. Reports reader and writer throughput and the latency of
+ * a write, including the wait for the lock.
+ *
+ */
+
+#include <stdio.h>     /* printf(), fprintf() */
+#include <stdlib.h>    /* abort(), malloc(), free(), atoi() */
+#include <stdint.h>    /* uint64_t */
+#include <pthread.h>   /* pthread_... */
+#include <stdbool.h>   /* true, false */
+#include <sched.h>     /* sched_yield() */
+#include <string.h>    /* strcmp(), strtok(), strdup() */
+#include <unistd.h>    /* getopt() */
+
+#include "timing.h"
+
+#define THREADS 4
+#define MAX_THREADS 64
+#define OPERATIONS 500000
+#define FIELDS 8
+#define CACHE_LINE 64
+
+/* Write probability in 1/10000 of each read/write ratio */
+struct ratio_t {
+    char *name;
+    int writes;
+};
+
+struct ratio_t ratios[] = {
+    { "50/50",    5000 },
+    { "90/10",    1000 },
+    { "99/1",      100 },
+    { "99.9/0.1",   10 },
+};
+
+#define RATIOS (int)(sizeof(ratios) / sizeof(ratios[0]))
+
+int threads = THREADS;
+int operations = OPERATIONS;
+
+/* The shared data, one cache line of versions */
+struct record {
+    long field[FIELDS];
+    struct record *next;    /* next retired record, RCU only */
+    uint64_t retired;       /* epoch in which it was retired, RCU only */
+};
+
+struct record shared __attribute__((aligned(CACHE_LINE)));
+
+/* Last version written, only changed by a writer holding the write lock */
+long version;
+
+static inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Returns true if all fields hold the same version */
+static inline bool
+consistent(const long *field)
+{
+    for (int i = 1; i < FIELDS; i++)
+        if (field[i] != field[0])
+            return false;
+    return true;
+}
+
+/* Mutex: readers serialize like writers */
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool mutex_read(int id __attribute__((unused))) {
+    long copy[FIELDS];
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; i < FIELDS; i++)
+        copy[i] = shared.field[i];
+    pthread_mutex_unlock(&mutex);
+    return consistent(copy);
+}
+
+void mutex_write(int id __attribute__((unused))) {
+    pthread_mutex_lock(&mutex);
+    version++;
+    for (int i = 0; i < FIELDS; i++)
+        shared.field[i] = version;
+    pthread_mutex_unlock(&mutex);
+}
+
+/* Reader-writer lock: readers share the lock, but every rdlock() still writes
+ * the reader count in the lock */
+pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+bool rwlock_read(int id __attribute__((unused))) {
+    long copy[FIELDS];
+    pthread_rwlock_rdlock(&rwlock);
+    for (int i = 0; i < FIELDS; i++)
+        copy[i] = shared.field[i];
+    pthread_rwlock_unlock(&rwlock);
+    return consistent(copy);
+}
+
+void rwlock_write(int id __attribute__((unused))) {
+    pthread_rwlock_wrlock(&rwlock);
+    version++;
+    for (int i = 0; i < FIELDS; i++)
+        shared.field[i] = version;
+    pthread_rwlock_unlock(&rwlock);
+}
+
+/* Seqlock: a writer makes the sequence number odd while it updates the
+ * record. Readers write nothing, they read the record optimistically and
+ * retry if the sequence number was odd or changed meanwhile. Writers
+ * serialize with writer_mutex. */
+#define SEQ_SPINS 64
+
+volatile unsigned seq __attribute__((aligned(CACHE_LINE)));
+pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool seqlock_read(int id __attribute__((unused))) {
+    long copy[FIELDS];
+    unsigned s1, s2;
+    int spins = 0;
+
+    do {
+        s1 = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            /* on a single CPU the writer can only finish if we give way */
+            if (++spins % SEQ_SPINS == 0)
+                sched_yield();
+            else
+                cpu_relax();
+            continue;
+        }
+        for (int i = 0; i < FIELDS; i++)
+            copy[i] = __atomic_load_n(&shared.field[i], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+    } while ((s1 & 1) || s1 != s2);
+
+    return consistent(copy);
+}
+
+void seqlock_write(int id __attribute__((unused))) {
+    pthread_mutex_lock(&writer_mutex);
+    unsigned s = seq;
+    __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    version++;
+    for (int i = 0; i < FIELDS; i++)
+        __atomic_store_n(&shared.field[i], version, __ATOMIC_RELAXED);
+    __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+/* RCU-style pointer swap: a writer copies the record, updates the copy and
+ * publishes it by swapping current. Readers only load the pointer, but must
+ * announce the epoch they read in so that the old record is not freed under
+ * them.
+ *
+ * A reader stores global_epoch in its slot of reader_epoch before it loads
+ * current and clears the slot when it is done. A writer retires the record it
+ * replaced in the epoch before it increments global_epoch. A reader that can
+ * still see the retired record announced that epoch or an earlier one, so a
+ * retired record is freed once every slot is 0 or holds a later epoch. All of
+ * these accesses are sequentially consistent. */
+struct record *current;
+uint64_t global_epoch __attribute__((aligned(CACHE_LINE))) = 1;
+
+struct {
+    uint64_t epoch;     /* 0 outside a read */
+} __attribute__((aligned(CACHE_LINE))) reader_epoch[MAX_THREADS];
+
+/* Retired records not freed yet, newest first, only touched by writers */
+struct record *limbo;
+
+bool rcu_read(int id) {
+    uint64_t e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader_epoch[id].epoch, e, __ATOMIC_SEQ_CST);
+    struct record *r = __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+    bool ok = consistent(r->field);
+    __atomic_store_n(&reader_epoch[id].epoch, 0, __ATOMIC_RELEASE);
+    return ok;
+}
+
+/* Frees the retired records no reader can see any more */
+static void
+rcu_reclaim()
+{
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < threads; i++) {
+        uint64_t e = __atomic_load_n(&reader_epoch[i].epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+
+    struct record **r = &limbo;
+    while (*r && (*r)->retired >= oldest)
+        r = &(*r)->next;
+    /* the rest is older still */
+    while (*r) {
+        struct record *old = *r;
+        *r = old->next;
+        free(old);
+    }
+}
+
+void rcu_write(int id __attribute__((unused))) {
+    struct record *r = malloc(sizeof(struct record));
+    if (r == NULL) {
+        perror("malloc");
+        abort();
+    }
+
+    pthread_mutex_lock(&writer_mutex);
+    version++;
+    for (int i = 0; i < FIELDS; i++)
+        r->field[i] = version;
+    struct record *old = __atomic_exchange_n(&current, r, __ATOMIC_SEQ_CST);
+    old->retired = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    old->next = limbo;
+    limbo = old;
+    rcu_reclaim();
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+/* Called before each run with no other thread running */
+void reset() {
+    memset(&shared, 0, sizeof(shared));
+    version = 0;
+    seq = 0;
+
+    while (limbo) {
+        struct record *r = limbo;
+        limbo = r->next;
+        free(r);
+    }
+    free(current);
+    current = calloc(1, sizeof(struct record));
+    if (current == NULL) {
+        perror("calloc");
+        abort();
+    }
+}
+
+struct scheme_t {
+    bool (*read)(int id);   /* returns false on a torn read */
+    void (*write)(int id);
+    char *name;
+    char *id;   /* selects the scheme with -l */
+};
+
+struct scheme_t schemes[] = {
+    { .read = mutex_read,   .write = mutex_write,   .name = "pthread mutex",  .id = "mutex" },
+    { .read = rwlock_read,  .write = rwlock_write,  .name = "pthread rwlock", .id = "rwlock" },
+    { .read = seqlock_read, .write = seqlock_write, .name = "seqlock",        .id = "seqlock" },
+    { .read = rcu_read,     .write = rcu_write,     .name = "rcu",            .id = "rcu" },
+    { .read = NULL,         .write = NULL,          .name = "stop",           .id = NULL }
+};
+
+struct thread_conf_t {
+    pthread_t tid;
+    int id;
+    struct scheme_t *scheme;
+    int writes;             /* write probability in 1/10000 */
+    long reads_done;
+    long writes_done;
+    long torn;
+    struct timing_hist write_latency;
+};
+
+pthread_barrier_t start_barrier;
+
+void *
+worker(void *arg)
+{
+    struct thread_conf_t *conf = arg;
+    uint64_t x = 0x9E3779B97F4A7C15ULL * (conf->id + 1);
+
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < operations; i++) {
+        /* xorshift64 */
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        if ((int)(x % 10000) < conf->writes) {
+            uint64_t start = timing_ticks();
+            conf->scheme->write(conf->id);
+            timing_hist_record(&conf->write_latency, timing_ticks() - start);
+            conf->writes_done++;
+        } else {
+            if (!conf->scheme->read(conf->id))
+                conf->torn++;
+            conf->reads_done++;
+        }
+    }
+
+    return NULL;
+}
+
+/* Runs one scheme at one ratio, returns false if a read was torn */
+bool
+run(struct scheme_t *scheme, struct ratio_t *ratio, struct thread_conf_t *conf)
+{
+    struct timespec ts;
+    struct timing_hist latency;
+    long reads = 0, writes = 0, torn = 0;
+
+    reset();
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++) {
+        conf[i].id = i;
+        conf[i].scheme = scheme;
+        conf[i].writes = ratio->writes;
+        conf[i].reads_done = conf[i].writes_done = conf[i].torn = 0;
+        timing_hist_init(&conf[i].write_latency);
+        if (pthread_create(&conf[i].tid, NULL, worker, &conf[i]) != 0) {
+            perror("pthread_create");
+            abort();
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    timing_start(&ts);
+    timing_hist_init(&latency);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(conf[i].tid, NULL);
+        reads += conf[i].reads_done;
+        writes += conf[i].writes_done;
+        torn += conf[i].torn;
+        timing_hist_merge(&latency, &conf[i].write_latency);
+    }
+    double secs = timing_stop(&ts);
+    pthread_barrier_destroy(&start_barrier);
+
+    printf("%-16s %-9s %12.3f %12.3f %10.0f %10.0f %10.0f  %s\n",
+           scheme->name, ratio->name, reads / secs / 1E6, writes / secs / 1E3,
+           timing_ticks_to_ns(timing_hist_percentile(&latency, 0.5)),
+           timing_ticks_to_ns(timing_hist_percentile(&latency, 0.99)),
+           timing_ticks_to_ns(timing_hist_percentile(&latency, 0.999)),
+           torn ? "FAIL: torn reads" : "ok");
+    fflush(stdout);
+
+    return torn == 0;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-i operations] [-l lock,...]\n"
+            "  -t  threads, every thread reads and writes (default %d, at most %d)\n"
+            "  -i  operations of each thread (default %d)\n"
+            "  -l  schemes to run, by id:",
+            prog, THREADS, MAX_THREADS, OPERATIONS);
+    for (struct scheme_t *s = schemes; s->read; s++)
+        fprintf(stderr, " %s", s->id);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+static bool
+selected(const char *locks, const char *id)
+{
+    if (locks == NULL)
+        return true;
+
+    char *list = strdup(locks);
+    bool found = false;
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ","))
+        if (strcmp(tok, id) == 0)
+            found = true;
+    free(list);
+    return found;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *locks = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:i:l:")) != -1) {
+        switch (opt) {
+        case 't': threads = atoi(optarg); break;
+        case 'i': operations = atoi(optarg); break;
+        case 'l': locks = optarg; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc || threads < 1 || threads > MAX_THREADS || operations < 1)
+        usage(argv[0]);
+
+    struct thread_conf_t *conf = malloc(threads * sizeof(struct thread_conf_t));
+    if (conf == NULL) {
+        perror("malloc");
+        abort();
+    }
+
+    printf("%d threads, %d operations each\n", threads, operations);
+    printf("%-16s %-9s %12s %12s %10s %10s %10s  %s\n", "lock", "read/write",
+           "reads M/s", "writes k/s", "write p50", "p99", "p99.9", "result");
+
+    bool ok = true;
+    for (struct scheme_t *s = schemes; s->read; s++) {
+        if (!selected(locks, s->id))
+            continue;
+        for (int r = 0; r < RATIOS; r++)
+            ok &= run(s, &ratios[r], conf);
+    }
+
+    free(conf);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * c-file-style: "stroustrup"
+ * End:
+ */
@@ -0,0 +1,143 @@
+#include <stdlib.h>     // abort(), atoi()
+#include <stdio.h>      // printf()
+#include <pthread.h>    // pthread_create()
+
+#include "semaphores.h" // s_init(), s_wait(), s_signal(), s_signal_n(), s_destroy()
+#include "timing.h"     // timing_start(), timing_ticks(), timing_hist_...
+
+/*
+  Cost of the semaphore backend.
+
+  uncontended  s_signal() followed by s_wait() in one thread, the counter
+               never drops to 0 and no thread sleeps
+  ping-pong    two threads signal each other's semaphore in turn like
+               semaphores_test, every round trip wakes both once
+  batch        the main thread releases WAITERS sleeping threads at once,
+               either with one s_signal() per thread or with one
+               s_signal_n(), and waits until all have passed; reports the
+               cost of the release call and of the whole round
+
+  The Makefile builds it once per Linux backend:
+
+    bin/semaphores_bench_glibc   sem_t from glibc
+    bin/semaphores_bench_futex   semaphores/futex_semaphores.c
+
+  Usage: bin/semaphores_bench_<backend> [rounds] [waiters]
+*/
+
+#define ROUNDS  100000
+#define WAITERS 8
+#define BATCHES 10 // batch rounds are rounds / BATCHES
+
+int rounds, waiters;
+semaphore_t *ping, *pong, *gate, *passed;
+
+void *ponger() {
+  for (int i = 0; i < rounds; i++) {
+    s_wait(ping);
+    s_signal(pong);
+  }
+  pthread_exit(0);
+}
+
+void print_latency(const char *what, struct timing_hist *h) {
+  printf("%-12s p50 %8.0f ns   p99 %8.0f ns   p99.9 %8.0f ns\n", what,
+         timing_ticks_to_ns(timing_hist_percentile(h, 0.5)),
+         timing_ticks_to_ns(timing_hist_percentile(h, 0.99)),
+         timing_ticks_to_ns(timing_hist_percentile(h, 0.999)));
+}
+
+void *waiter() {
+  for (int i = 0; i < 2 * (rounds / BATCHES); i++) {
+    s_wait(gate);
+    s_signal(passed);
+  }
+  pthread_exit(0);
+}
+
+void batch(int batched) {
+  struct timing_hist release, round;
+
+  timing_hist_init(&release);
+  timing_hist_init(&round);
+  for (int i = 0; i < rounds / BATCHES; i++) {
+    uint64_t start = timing_ticks();
+    if (batched) {
+      s_signal_n(gate, waiters);
+    } else {
+      for (int w = 0; w < waiters; w++) {
+        s_signal(gate);
+      }
+    }
+    timing_hist_record(&release, timing_ticks() - start);
+    for (int w = 0; w < waiters; w++) {
+      s_wait(passed);
+    }
+    timing_hist_record(&round, timing_ticks() - start);
+  }
+  printf("batch %s, %d waiters\n", batched ? "s_signal_n()" : "s_signal() x n", waiters);
+  print_latency("  release", &release);
+  print_latency("  round", &round);
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t tid;
+  struct timespec ts;
+  struct timing_hist h;
+
+  rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+  waiters = argc > 2 ? atoi(argv[2]) : WAITERS;
+  ping = s_init(0);
+  pong = s_init(0);
+  gate = s_init(0);
+  passed = s_init(0);
+
+  timing_hist_init(&h);
+  timing_start(&ts);
+  for (int i = 0; i < rounds; i++) {
+    uint64_t start = timing_ticks();
+    s_signal(ping);
+    s_wait(ping);
+    timing_hist_record(&h, timing_ticks() - start);
+  }
+  printf("uncontended  %8.1f ns per s_signal() + s_wait()\n",
+         timing_stop(&ts) * 1E9 / rounds);
+  print_latency("", &h);
+
+  if (pthread_create(&tid, NULL, ponger, NULL) != 0) {
+    perror("pthread_create()");
+    abort();
+  }
+
+  timing_hist_init(&h);
+  timing_start(&ts);
+  for (int i = 0; i < rounds; i++) {
+    uint64_t start = timing_ticks();
+    s_signal(ping);
+    s_wait(pong);
+    timing_hist_record(&h, timing_ticks() - start);
+  }
+  printf("ping-pong    %8.1f ns per round trip\n", timing_stop(&ts) * 1E9 / rounds);
+  print_latency("", &h);
+
+  pthread_join(tid, NULL);
+
+  pthread_t tids[waiters];
+  for (int w = 0; w < waiters; w++) {
+    if (pthread_create(&tids[w], NULL, waiter, NULL) != 0) {
+      perror("pthread_create()");
+      abort();
+    }
+  }
+  batch(0);
+  batch(1);
+  for (int w = 0; w < waiters; w++) {
+    pthread_join(tids[w], NULL);
+  }
+
+  s_destroy(ping);
+  s_destroy(pong);
+  s_destroy(gate);
+  s_destroy(passed);
+  return 0;
+}
@@ -4,15 +4,21 @@
 #include <pthread.h>    // pthread_create()
 
 #include "semaphores.h" // s_init(), s_wait(), s_signal(), s_destroy()
+#include "timing.h"     // timing_ticks(), timing_hist_...
 
 #define N     5
 #define SLEEP 1
 
 semaphore_t *sem;
 
+// time of the last s_signal() and from it until s_wait() returned
+volatile uint64_t signaled;
+struct timing_hist wakeup;
+
 void *thread() {
   for (int i = 0; i < N; i++) {
     sleep(SLEEP);
+    signaled = timing_ticks();
     s_signal(sem);
   }
   pthread_exit(0);
@@ -21,6 +27,7 @@ void *thread() {
 int main(void) {
   pthread_t tid;
   sem = s_init(0);
+  timing_hist_init(&wakeup);
 
   if (pthread_create(&tid, NULL, thread, NULL) != 0) {
     perror("pthread_create()");
@@ -30,9 +37,15 @@ int main(void) {
  for (int i = 0; i < N; i++) {
    printf("  main(%d) waiting on a semaphore ...\n", i);
    s_wait(sem);
+   timing_hist_record(&wakeup, timing_ticks() - signaled);
    printf("  main(%d)     semaphore signaled by thread.\n", i);
  }
 
  s_destroy(sem);
 
+ printf("wake-up latency: p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns\n",
+        timing_ticks_to_ns(timing_hist_percentile(&wakeup, 0.5)),
+        timing_ticks_to_ns(timing_hist_percentile(&wakeup, 0.99)),
+        timing_ticks_to_ns(timing_hist_percentile(&wakeup, 0.999)));
+
 }
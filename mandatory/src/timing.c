@@ -6,10 +6,21 @@
  * $Id: timing.c 1009 2011-07-28 15:02:57Z ansan501 $
  */
 
+/* syscall() is not declared with only _XOPEN_SOURCE */
+#define _GNU_SOURCE
+
 #include "timing.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 /* Use the monotonic high resolution clock by default. This clock
  * can't be set and is guaranteed not to jump backwards. The clock has
@@ -66,6 +77,189 @@ timing_stop(struct timespec *ts_start)
                 (ts.tv_nsec - ts_start->tv_nsec) * 1E-9;
 }
 
+const char *timing_counter_names[TIMING_NCOUNTERS] = {
+        "cycles", "instructions", "LLC misses", "context switches"
+};
+
+#ifdef __linux__
+static const struct {
+        __u32 type;
+        __u64 config;
+} counter_events[TIMING_NCOUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* Opens one counter of the calling thread, disabled, in the group of
+ * leader (-1 for a new group). Kernel events are excluded when
+ * perf_event_paranoid does not allow counting them. */
+static int
+counter_open(int counter, int leader)
+{
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_events[counter].type;
+        attr.config = counter_events[counter].config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd < 0) {
+                attr.exclude_kernel = 1;
+                fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        }
+        return fd;
+}
+#endif
+
+int
+timing_counters_start(struct timing_counters *c)
+{
+        int leader = -1, available = 0;
+
+        for (int i = 0; i < TIMING_NCOUNTERS; i++) {
+                c->fd[i] = -1;
+                c->value[i] = -1;
+#ifdef __linux__
+                c->fd[i] = counter_open(i, leader);
+                /* the group may not fit in the PMU, count outside of it */
+                if (c->fd[i] < 0 && leader >= 0)
+                        c->fd[i] = counter_open(i, -1);
+                if (c->fd[i] < 0)
+                        continue;
+                if (leader < 0)
+                        leader = c->fd[i];
+                available++;
+#endif
+        }
+
+#ifdef __linux__
+        for (int i = 0; i < TIMING_NCOUNTERS; i++) {
+                if (c->fd[i] >= 0) {
+                        ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+                        ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+                }
+        }
+#endif
+        return available;
+}
+
+void
+timing_counters_stop(struct timing_counters *c)
+{
+#ifdef __linux__
+        for (int i = 0; i < TIMING_NCOUNTERS; i++) {
+                if (c->fd[i] >= 0)
+                        ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+
+        for (int i = 0; i < TIMING_NCOUNTERS; i++) {
+                /* value, time enabled, time running */
+                __u64 data[3];
+
+                if (c->fd[i] < 0)
+                        continue;
+                if (read(c->fd[i], data, sizeof(data)) == sizeof(data) &&
+                    data[2] > 0) {
+                        c->value[i] = data[2] < data[1] ?
+                                (long long)((double)data[0] * data[1] / data[2]) :
+                                (long long)data[0];
+                }
+                close(c->fd[i]);
+                c->fd[i] = -1;
+        }
+#endif
+}
+
+/* Nanoseconds per tick of timing_ticks(), 0 until calibrated */
+static double ns_per_tick = 0;
+
+void
+timing_calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+        struct timespec start, now;
+        double elapsed;
+
+        checked_gettime(&start);
+        uint64_t ticks = timing_ticks();
+        do {
+                checked_gettime(&now);
+                elapsed = (now.tv_sec - start.tv_sec) * 1E9 +
+                        (now.tv_nsec - start.tv_nsec);
+        } while (elapsed < 10E6);
+        ns_per_tick = elapsed / (timing_ticks() - ticks);
+#else
+        ns_per_tick = 1;
+#endif
+}
+
+double
+timing_ticks_to_ns(uint64_t ticks)
+{
+        if (ns_per_tick == 0)
+                timing_calibrate();
+        return ticks * ns_per_tick;
+}
+
+void
+timing_hist_init(struct timing_hist *h)
+{
+        memset(h, 0, sizeof(*h));
+        h->min = UINT64_MAX;
+}
+
+void
+timing_hist_merge(struct timing_hist *dst, const struct timing_hist *src)
+{
+        for (int i = 0; i < TIMING_HIST_BUCKETS; i++)
+                dst->count[i] += src->count[i];
+        dst->total += src->total;
+        if (src->min < dst->min)
+                dst->min = src->min;
+        if (src->max > dst->max)
+                dst->max = src->max;
+}
+
+/* Middle of the range of values counted in a bucket */
+static uint64_t
+bucket_value(int bucket)
+{
+        if (bucket < TIMING_HIST_SUB)
+                return bucket;
+        int shift = bucket / TIMING_HIST_SUB - 1;
+        uint64_t low = (uint64_t)(TIMING_HIST_SUB + bucket % TIMING_HIST_SUB) << shift;
+        return low + ((uint64_t)1 << shift) / 2;
+}
+
+uint64_t
+timing_hist_percentile(const struct timing_hist *h, double p)
+{
+        if (h->total == 0)
+                return 0;
+
+        /* nearest rank */
+        uint64_t rank = (uint64_t)(p * h->total + 0.999999);
+        uint64_t seen = 0;
+        if (rank < 1)
+                rank = 1;
+        for (int i = 0; i < TIMING_HIST_BUCKETS; i++) {
+                seen += h->count[i];
+                if (seen >= rank) {
+                        uint64_t value = bucket_value(i);
+                        return value < h->min ? h->min :
+                                value > h->max ? h->max : value;
+                }
+        }
+        return h->max;
+}
+
 /*
  * Local Variables:
  * mode: c
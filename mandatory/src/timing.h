@@ -10,6 +10,7 @@
 #define TIMING_H
 
 #include <time.h>
+#include <stdint.h>
 
 /**
  * Get the precision of the timer exposed by the underlying OS.
@@ -34,6 +35,167 @@ extern void timing_start(struct timespec *ts);
  */
 extern double timing_stop(struct timespec *ts_start);
 
+/**
+ * Hardware and kernel counters collected by a counter group.
+ */
+enum timing_counter {
+        TIMING_CYCLES,
+        TIMING_INSTRUCTIONS,
+        TIMING_LLC_MISSES,
+        TIMING_CONTEXT_SWITCHES,
+        TIMING_NCOUNTERS
+};
+
+/**
+ * Printable names of the counters, indexed by enum timing_counter.
+ */
+extern const char *timing_counter_names[TIMING_NCOUNTERS];
+
+/**
+ * A group of counters measuring the calling thread.
+ */
+struct timing_counters {
+        int fd[TIMING_NCOUNTERS];          /* -1 if the counter is unavailable */
+        long long value[TIMING_NCOUNTERS]; /* deltas, -1 if unavailable */
+};
+
+/**
+ * Opens and starts the counters for the calling thread with
+ * perf_event_open(). Counters that the CPU, the kernel or
+ * perf_event_paranoid do not allow are marked unavailable, on systems
+ * without perf all of them are.
+ *
+ * \param c Pointer to the counter group to start.
+ * \return Number of available counters.
+ */
+extern int timing_counters_start(struct timing_counters *c);
+
+/**
+ * Stops the counters started by timing_counters_start() in the same
+ * thread and stores their deltas in c->value. Values are scaled up if
+ * the kernel had to multiplex the counters.
+ *
+ * \param c Pointer to the counter group to stop.
+ */
+extern void timing_counters_stop(struct timing_counters *c);
+
+/**
+ * Reads a cheap timestamp counter: rdtscp on x86, cntvct_el0 on
+ * AArch64 and CLOCK_MONOTONIC in ns elsewhere. Ticks are only
+ * meaningful as differences, convert them with timing_ticks_to_ns().
+ *
+ * \return Current tick count.
+ */
+static inline uint64_t
+timing_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t lo, hi, aux;
+        /* rdtscp waits for the preceding instructions to complete */
+        __asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+        return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(ticks) :: "memory");
+        return ticks;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Measures the tick rate of timing_ticks() against CLOCK_MONOTONIC by
+ * spinning for a few milliseconds. Called by the first
+ * timing_ticks_to_ns() if it was not called before.
+ */
+extern void timing_calibrate();
+
+/**
+ * Converts a number of ticks of timing_ticks() to nanoseconds.
+ *
+ * \param ticks Difference of two timing_ticks() values.
+ * \return Length in nanoseconds.
+ */
+extern double timing_ticks_to_ns(uint64_t ticks);
+
+/* Each power of two of the histogram range is split into
+ * 2^TIMING_HIST_SUB_BITS linear buckets, which bounds the relative
+ * error of a recorded value to 2^-TIMING_HIST_SUB_BITS. */
+#define TIMING_HIST_SUB_BITS 5
+#define TIMING_HIST_SUB      (1 << TIMING_HIST_SUB_BITS)
+#define TIMING_HIST_BUCKETS  ((64 - TIMING_HIST_SUB_BITS + 1) * TIMING_HIST_SUB)
+
+/**
+ * Log-linear (HDR style) histogram of 64-bit values, typically ticks
+ * or nanoseconds. A histogram is recorded by one thread, histograms
+ * of several threads are combined with timing_hist_merge().
+ */
+struct timing_hist {
+        uint64_t count[TIMING_HIST_BUCKETS];
+        uint64_t total;         /* number of recorded values */
+        uint64_t min, max;
+};
+
+/**
+ * Clears a histogram.
+ *
+ * \param h Pointer to the histogram.
+ */
+extern void timing_hist_init(struct timing_hist *h);
+
+/**
+ * Bucket of a value: values below TIMING_HIST_SUB have their own
+ * bucket, larger ones keep the TIMING_HIST_SUB_BITS bits below their
+ * most significant bit.
+ */
+static inline int
+timing_hist_bucket(uint64_t value)
+{
+        if (value < TIMING_HIST_SUB)
+                return value;
+        int shift = 63 - __builtin_clzll(value) - TIMING_HIST_SUB_BITS;
+        return (shift + 1) * TIMING_HIST_SUB +
+                (int)(value >> shift) - TIMING_HIST_SUB;
+}
+
+/**
+ * Records one value.
+ *
+ * \param h Pointer to the histogram.
+ * \param value Value to record.
+ */
+static inline void
+timing_hist_record(struct timing_hist *h, uint64_t value)
+{
+        h->count[timing_hist_bucket(value)]++;
+        h->total++;
+        if (value < h->min)
+                h->min = value;
+        if (value > h->max)
+                h->max = value;
+}
+
+/**
+ * Adds the values recorded in src to dst.
+ *
+ * \param dst Pointer to the histogram to add to.
+ * \param src Pointer to the histogram to add.
+ */
+extern void timing_hist_merge(struct timing_hist *dst,
+                              const struct timing_hist *src);
+
+/**
+ * Returns the value below which a fraction p of the recorded values
+ * lie, within the precision of the buckets.
+ *
+ * \param h Pointer to the histogram.
+ * \param p Fraction between 0 and 1, e.g. 0.99 for the 99th percentile.
+ * \return The value, 0 if nothing was recorded.
+ */
+extern uint64_t timing_hist_percentile(const struct timing_hist *h, double p);
+
 #endif
 
 /*